@@ -38,6 +38,30 @@
 #include <linux/tty_flip.h>
 #include <linux/serial.h>
 #include <linux/sched.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/list.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/string.h>
 #include <asm/uaccess.h>
 #include <linux/version.h>
 
@@ -45,175 +69,1911 @@
 #include <linux/sched/signal.h>
 #endif
 
+#define CREATE_TRACE_POINTS
+#include "tty0tty_trace.h"
+#include "tty0tty_capture.h"
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
 
-static int user_termios_to_kernel_termios(struct ktermios *k,
-						 struct termios2 __user *u)
-{
-	return copy_from_user(k, u, sizeof(struct termios2));
-}
+static int user_termios_to_kernel_termios(struct ktermios *k,
+						 struct termios2 __user *u)
+{
+	return copy_from_user(k, u, sizeof(struct termios2));
+}
+
+static int kernel_termios_to_user_termios(struct termios2 __user *u,
+						 struct ktermios *k)
+{
+	return copy_to_user(u, k, sizeof(struct termios2));
+}
+static int user_termios_to_kernel_termios_1(struct ktermios *k,
+						   struct termios __user *u)
+{
+	return copy_from_user(k, u, sizeof(struct termios));
+}
+
+static int kernel_termios_to_user_termios_1(struct termios __user *u,
+						   struct ktermios *k)
+{
+	return copy_to_user(u, k, sizeof(struct termios));
+}
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+int tty_check_change(struct tty_struct *tty);
+speed_t tty_termios_input_baud_rate(struct ktermios *termios);
+#else
+#ifndef tty_alloc_driver
+#define tty_alloc_driver(x, y) alloc_tty_driver(x)
+#endif
+#define tty_driver_kref_put(x) put_tty_driver(x)
+#endif
+
+#ifndef smp_load_acquire
+#define smp_load_acquire(p) ({ typeof(*(p)) ___v = ACCESS_ONCE(*(p)); smp_mb(); ___v; })
+#define smp_store_release(p, v) do { smp_mb(); ACCESS_ONCE(*(p)) = (v); } while (0)
+#endif
+
+#ifndef READ_ONCE
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#define WRITE_ONCE(x, v) (ACCESS_ONCE(x) = (v))
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 11, 0)
+#define get_random_u32() get_random_int()
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+#define vm_flags_clear(vma, flags) ((vma)->vm_flags &= ~(flags))
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define TTY0TTY_BIN_CONST const
+#else
+#define TTY0TTY_BIN_CONST
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+#define __poll_t unsigned int
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLOUT POLLOUT
+#define EPOLLWRNORM POLLWRNORM
+#endif
+
+#define DRIVER_VERSION "v1.4"
+#define DRIVER_AUTHOR "Luis Claudio Gamboa Lopes <lcgamboa@yahoo.com>"
+#define DRIVER_DESC "tty0tty null modem driver"
+
+/* Module information */
+MODULE_AUTHOR(DRIVER_AUTHOR);
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE("GPL");
+
+static unsigned int pairs = 4;
+module_param(pairs, uint, 0444);
+MODULE_PARM_DESC(pairs, "Number of port pairs created at load (default 4)");
+
+static unsigned int max_pairs = 64;
+module_param(max_pairs, uint, 0444);
+MODULE_PARM_DESC(max_pairs, "Number of pairs that can exist, created at load or through tnt_ctl (1-4096, default 64)");
+
+static unsigned int bufsize = 4096;
+module_param(bufsize, uint, 0444);
+MODULE_PARM_DESC(bufsize, "Transmit buffer size of each port in bytes (256-65536, power of two)");
+
+
+#define TTY0TTY_MAJOR		0	/* dynamic allocation of major number */
+#define TTY0TTY_MAX_PAIRS	4096	/* limit of the max_pairs parameter */
+#define TTY0TTY_RING_MIN	256	/* transmit ring size limits */
+#define TTY0TTY_RING_MAX	65536
+#define TTY0TTY_WAKEUP_CHARS	256	/* wake the writer below this */
+#define TTY0TTY_PACE_BATCH_NS	NSEC_PER_MSEC	/* pacing timer period */
+#define TTY0TTY_RETRY_MAX	(HZ / 50)	/* backoff limit of a full peer, jiffies */
+
+/* fake UART values */
+//out
+#define MCR_DTR		0x01
+#define MCR_RTS		0x02
+#define MCR_LOOP	0x04
+//in
+#define MSR_CTS		0x10
+#define MSR_CD		0x20
+#define MSR_DSR		0x40
+#define MSR_RI		0x80
+
+
+/*
+ * Single producer / single consumer byte ring. The producer is
+ * tty0tty_write() under write_lock: the tty layer does not serialize
+ * all the writes to a port, n_tty echoes and tty_send_xchar() (TCXONC)
+ * can run next to a write(). The consumer is whoever owns
+ * TTY0TTY_DRAINING. head and tail are free running and only ever
+ * written by their owner.
+ */
+struct tty0tty_ring {
+	unsigned char		*buf;
+	unsigned int		size;		/* power of two */
+	unsigned int		head;		/* written by the producer */
+	unsigned int		tail;		/* written by the consumer */
+	unsigned int		limit;		/* usable bytes, xmit_fifo_size */
+};
+
+/* tty0tty_serial flags bits */
+#define TTY0TTY_DRAINING	0	/* someone is moving xmit to the peer */
+#define TTY0TTY_FLUSH		1	/* discard xmit on the next drain */
+#define TTY0TTY_THROTTLED	2	/* our line discipline wants no more data */
+#define TTY0TTY_PACING		3	/* pace_timer owns the delivery */
+#define TTY0TTY_BREAK		4	/* a break waits to be sent to the peer */
+#define TTY0TTY_PUSH		5	/* push_timer will push our flip buffer */
+#define TTY0TTY_WIRE		6	/* /dev/tntdN is open, it is the other end */
+#define TTY0TTY_DELAY_DUE	7	/* delay_timer fired, a mark may be due */
+
+/* batching window of the pushes without ASYNC_LOW_LATENCY or coalesce_usecs */
+#define TTY0TTY_PUSH_DELAY_NS	NSEC_PER_MSEC
+#define TTY0TTY_COALESCE_MAX_US	USEC_PER_SEC
+
+/* why tty0tty_deliver() stopped early */
+#define TTY0TTY_STALL_BLOCKED	1	/* flow control, a kick will follow */
+#define TTY0TTY_STALL_FULL	2	/* peer flip buffer full, retry later */
+#define TTY0TTY_STALL_DELAY	3	/* link emulation, delay_timer will drain */
+
+/*
+ * Link emulation (delay_us, jitter_us, rate_limit): each write gets a
+ * mark with the time its bytes leave the far end of the link, the data
+ * itself waits in xmit. Marks are a single producer / single consumer
+ * queue like xmit, a full queue makes tty0tty_write() wait.
+ */
+#define TTY0TTY_DELAY_MARKS	256	/* writes in flight, power of two */
+#define TTY0TTY_DELAY_MAX_US	(10 * USEC_PER_SEC)
+
+struct tty0tty_mark {
+	unsigned int		start;		/* xmit positions of the write */
+	unsigned int		end;
+	u64			release;	/* ns, CLOCK_MONOTONIC */
+};
+
+struct tty0tty_delay {
+	unsigned int		head;		/* written by tty0tty_write() */
+	unsigned int		tail;		/* written by the TTY0TTY_DRAINING owner */
+	u64			link_free;	/* end of the last write on the link */
+	u64			last_release;	/* the data keeps its order with jitter */
+	struct tty0tty_mark	mark[TTY0TTY_DELAY_MARKS];
+};
+
+/*
+ * Strict line emulation: what the peer receives for each byte value,
+ * with the frame format of the writer sampled by the reader. Built by
+ * tty0tty_build_xlat() when either end changes termios.
+ */
+struct tty0tty_xlat {
+	struct rcu_head		rcu;
+	unsigned char		ch[256];
+	char			flag[256];
+};
+
+/*
+ * Bus and star topologies, defined with /sys/class/misc/tnt_ctl/topology.
+ * On a bus every write goes to all the other members, on a star the
+ * hub (member[0]) talks to all the others and they only to the hub.
+ * Members are out of their pair, see get_shadow_tty().
+ */
+#define TTY0TTY_TOPO_BUS	1
+#define TTY0TTY_TOPO_STAR	2
+#define TTY0TTY_GROUP_MAX	256	/* members of one bus or star */
+
+struct tty0tty_group {
+	struct rcu_head		rcu;
+	struct list_head	list;		/* tty0tty_groups */
+	int			mode;		/* TTY0TTY_TOPO_* */
+	unsigned int		count;
+	unsigned int		member[];	/* port indexes */
+};
+
+/*
+ * Capture ring of all the traffic of a pair, for passive monitors.
+ * vmalloc_user() memory mapped read only through the bin attribute
+ * 'capture', layout in tty0tty_capture.h. The writers never wait for
+ * the readers, old records are overwritten.
+ */
+#define TTY0TTY_CAPTURE_MIN	PAGE_SIZE	/* capture_size limits */
+#define TTY0TTY_CAPTURE_MAX	(64 << 20)
+#define TTY0TTY_CAPTURE_CHUNK	4096		/* data bytes of one record */
+
+struct tty0tty_capture {
+	spinlock_t		lock;		/* serializes the two ports */
+	struct tty0tty_capture_hdr *hdr;	/* first page, the data follows */
+	unsigned char		*data;
+	unsigned int		size;		/* of the data area, power of two */
+	u64			head;		/* under lock, published in hdr */
+};
+
+/* fault_mode values, what happens to a byte hit by fault injection */
+#define TTY0TTY_FAULT_CORRUPT	0	/* one bit flipped */
+#define TTY0TTY_FAULT_DROP	1	/* lost on the line */
+#define TTY0TTY_FAULT_PARITY	2	/* received with a parity error */
+#define TTY0TTY_FAULT_FRAME	3	/* received with a framing error */
+#define TTY0TTY_FAULT_OVERRUN	4	/* lost in an overrun of the peer */
+
+struct tty0tty_serial {
+	struct tty_port		port;		/* port.tty is the open tty, see tty_port_tty_get() */
+	struct device		*dev;		/* tntN in sysfs */
+	atomic_t		open_count;	/* number of times this port has been opened */
+	struct semaphore	sem;		/* serializes open/close */
+	int			index;		/* tty index of this port */
+	struct tty0tty_serial __rcu *peer;	/* the other end while it is open */
+
+	/* write path, never takes sem */
+	spinlock_t		write_lock;	/* serializes the producers of xmit */
+	struct tty0tty_ring	xmit;		/* data written and not yet delivered */
+	unsigned long		flags;
+	char			rx_flag;	/* flag delivered with each byte */
+	char			crtscts;	/* hold xmit while CTS is low */
+	struct delayed_work	retry;		/* drain again when the peer was full */
+	unsigned long		retry_delay;	/* next backoff, jiffies */
+
+	/* pushes of the data received, see tty0tty_push() */
+	spinlock_t		rx_lock;	/* serializes the writers of our flip buffer */
+	char			low_latency;	/* ASYNC_LOW_LATENCY, push at once */
+	unsigned int		coalesce_bytes;	/* push when this much waits, 0 no limit */
+	u64			coalesce_ns;	/* push window, 0 no coalescing */
+	unsigned int		push_bytes;	/* waiting for the push, under rx_lock */
+	u64			push_start;	/* lat_start of the oldest of them, under rx_lock */
+	int			push_from;	/* writer of the last of them, for the trace */
+	struct hrtimer		push_timer;
+
+	/* baud rate pacing, see tty0tty_pace_timer() */
+	char			pacing;		/* sysfs switch */
+	u64			char_ns;	/* line time of one character */
+	u64			pace_next;	/* end of the last character sent */
+	struct hrtimer		pace_timer;
+
+	/* link emulation of the data sent, see struct tty0tty_delay */
+	char			delay_on;	/* any of the three below is set */
+	unsigned int		delay_us;
+	unsigned int		jitter_us;
+	unsigned int		rate_limit;	/* bits per second, 0 no limit */
+	struct tty0tty_delay	*delay;		/* allocated on first use */
+	struct hrtimer		delay_timer;
+
+	/* strict line emulation of the data received, see struct tty0tty_xlat */
+	char			strict;		/* sysfs switch */
+	unsigned int		cflag;		/* frame format, c_cflag of the last open or set_termios */
+	struct tty0tty_xlat __rcu *rx_xlat;	/* NULL if off or nothing to change */
+
+	/* wire side of the port, /dev/tntdN, see tty0tty_wire_fops */
+	struct device		*wire_dev;
+	wait_queue_head_t	wire_wait;	/* data to read, room to write, xmit free */
+	atomic_t		wire_room;	/* bumped when tntN may take more */
+	unsigned char		*wire_buf;	/* one page while open */
+
+	/* bus or star the port belongs to, NULL for a pair */
+	struct tty0tty_group __rcu *group;
+
+	/* traffic of the pair, even ports only, see tty0tty_capture() */
+	struct tty0tty_capture __rcu *capture;
+
+	/* fault injection on the data sent, see tty0tty_insert_faults() */
+	unsigned int		fault_rate;	/* bytes per million, 0 is off */
+	char			fault_mode;	/* TTY0TTY_FAULT_* */
+
+	/* for tiocmget and tiocmset functions */
+	spinlock_t		msr_lock;	/* msr, the modem counters in icount */
+	int			msr;		/* MSR shadow */
+	int			mcr;		/* MCR shadow */
+
+	/* for ioctl fun */
+	struct serial_struct	serial;
+	wait_queue_head_t	wait;
+	struct async_icount	icount;		/* rx and tx are in the counters below */
+
+	/* byte counters, updated once per delivered block */
+	atomic64_t		tx_bytes;	/* delivered to the peer */
+	atomic64_t		rx_bytes;	/* received from the peer */
+	atomic64_t		dropped;	/* written with nobody listening, or flushed */
+	atomic64_t		pushes;		/* wakeups of our line discipline */
+
+	/* previous read of the 'stats' attribute, for the rates */
+	spinlock_t		stats_lock;
+	u64			stats_time;
+	u64			stats_tx;
+	u64			stats_rx;
+
+	/* oldest write not yet delivered to the peer, for the latency histogram */
+	u64			lat_start;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * all ports in one block, tnt(2n) and tnt(2n+1) are a pair. A port
+ * exists in /dev when dev is set, see tty0tty_create_pair().
+ */
+static struct tty0tty_serial *tty0tty_table;
+static unsigned int tty0tty_minors;
+
+/*
+ * write to push latency, /sys/kernel/debug/tty0tty/latency. Bucket n
+ * counts latencies from 2^(n-1) to 2^n - 1 ns, the last one everything
+ * above. Off by default, latency_enable switches it on.
+ */
+#define TTY0TTY_LAT_BUCKETS	40
+
+struct tty0tty_lat_hist {
+	u64			count[TTY0TTY_LAT_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct tty0tty_lat_hist, tty0tty_lat_hist);
+static bool tty0tty_lat_enable;
+static struct dentry *tty0tty_debugfs;
+
+static DEFINE_MUTEX(tty0tty_capture_mutex);	/* serializes capture_size changes */
+
+static struct tty0tty_capture *tty0tty_capture_alloc(unsigned int size)
+{
+	struct tty0tty_capture *cap;
+
+	cap = kzalloc(sizeof(*cap), GFP_KERNEL);
+	if (!cap)
+		return NULL;
+
+	/* zeroed, user space sees a valid empty ring */
+	cap->hdr = vmalloc_user(PAGE_SIZE + size);
+	if (!cap->hdr) {
+		kfree(cap);
+		return NULL;
+	}
+	spin_lock_init(&cap->lock);
+	cap->data = (unsigned char *)cap->hdr + PAGE_SIZE;
+	cap->size = size;
+	cap->hdr->version = TTY0TTY_CAPTURE_VERSION;
+	cap->hdr->data_offset = PAGE_SIZE;
+	cap->hdr->data_size = size;
+	return cap;
+}
+
+/* after it is unpublished, mappings keep their pages until munmap() */
+static void tty0tty_capture_free(struct tty0tty_capture *cap)
+{
+	if (!cap)
+		return;
+
+	synchronize_rcu();
+	vfree(cap->hdr);
+	kfree(cap);
+}
+
+/* the pair of the port has a capture ring, a cheap test for the hot paths */
+static inline bool tty0tty_capturing(struct tty0tty_serial *tty0tty)
+{
+	return rcu_access_pointer(tty0tty_table[tty0tty->index & ~1].capture);
+}
+
+/* one record of at most TTY0TTY_CAPTURE_CHUNK bytes, under cap->lock */
+static void tty0tty_capture_add(struct tty0tty_capture *cap,
+		struct tty0tty_serial *tty0tty, int type,
+		const unsigned char *data, unsigned int count)
+{
+	struct tty0tty_capture_rec *rec;
+	unsigned int len = ALIGN(sizeof(*rec) + count, 8);
+	unsigned int off = cap->head & (cap->size - 1);
+
+	/* records do not wrap */
+	if (cap->size - off < len) {
+		if (cap->size - off >= sizeof(*rec)) {
+			rec = (struct tty0tty_capture_rec *)(cap->data + off);
+			memset(rec, 0, sizeof(*rec));
+			rec->type = TTY0TTY_CAP_PAD;
+		}
+		cap->head += cap->size - off;
+		off = 0;
+	}
+
+	rec = (struct tty0tty_capture_rec *)(cap->data + off);
+	rec->time_ns = ktime_get_ns();
+	rec->len = len;
+	rec->count = count;
+	rec->type = type;
+	rec->port = tty0tty->index & 1;
+	rec->flags = type == TTY0TTY_CAP_DATA ? tty0tty->rx_flag : TTY_NORMAL;
+	rec->lines = READ_ONCE(tty0tty->mcr) | READ_ONCE(tty0tty->msr);
+	memcpy(rec + 1, data, count);
+
+	cap->head += len;
+	smp_store_release(&cap->hdr->head, cap->head);
+}
+
+/* append an event of the port to the capture ring of its pair, if any */
+static void tty0tty_capture(struct tty0tty_serial *tty0tty, int type,
+			    const unsigned char *data, unsigned int count)
+{
+	struct tty0tty_capture *cap;
+	unsigned long flags;
+	unsigned int chunk;
+	unsigned int n;
+
+	rcu_read_lock();
+	cap = rcu_dereference(tty0tty_table[tty0tty->index & ~1].capture);
+	if (cap) {
+		chunk = min_t(unsigned int, cap->size / 4, TTY0TTY_CAPTURE_CHUNK);
+
+		spin_lock_irqsave(&cap->lock, flags);
+		do {
+			n = min(count, chunk);
+			tty0tty_capture_add(cap, tty0tty, type, data, n);
+			data += n;
+			count -= n;
+		} while (count);
+		spin_unlock_irqrestore(&cap->lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+
+
+static void tty0tty_kick(struct tty0tty_serial *tty0tty);
+static void tty0tty_build_xlat(struct tty0tty_serial *tty0tty);
+
+/*attributes*/
+
+/*
+ * /sys/device/virtual/tty/tntx/
+ *
+ * the attribute 'baudrate' contains the baudrate of virtual serial 
+ * port (return 0 if port is not open) and it supports poll() 
+ * to detect when value is changed.
+ */
+
+/* Sysfs attribute */
+static ssize_t baudrate_show(struct device *dev,
+			    struct device_attribute *attr, char *buf){
+	int baud = 0;
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	struct tty_struct *tty;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s \n", __FUNCTION__);
+#endif
+
+	if (!tty0tty)
+		return sprintf(buf, "%i\n", baud);
+
+	/* a reference, the port may be closing */
+	tty = tty_port_tty_get(&tty0tty->port);
+	if (tty) {
+		baud = tty_get_baud_rate(tty);
+		tty_kref_put(tty);
+	}
+
+	return sprintf(buf, "%i\n", baud);
+}
+
+static DEVICE_ATTR_RO(baudrate);
+
+/*
+ * the attribute 'pacing' (0 or 1) delivers the data to the other side
+ * at the speed set by termios (baud, data bits, parity and stop bits)
+ * instead of immediately.
+ */
+static ssize_t pacing_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%i\n", tty0tty->pacing);
+}
+
+static ssize_t pacing_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	tty0tty->pacing = val ? 1 : 0;
+	if (!val) {
+		hrtimer_cancel(&tty0tty->pace_timer);
+		clear_bit(TTY0TTY_PACING, &tty0tty->flags);
+		tty0tty_kick(tty0tty);
+	}
+	return count;
+}
+
+static DEVICE_ATTR_RW(pacing);
+
+/*
+ * the attribute 'stats' contains the byte and error counters of the
+ * port since it was opened. The rates are averaged over the time since
+ * the previous read of the attribute.
+ */
+static ssize_t stats_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	u64 now = ktime_to_ns(ktime_get());
+	u64 tx = atomic64_read(&tty0tty->tx_bytes);
+	u64 rx = atomic64_read(&tty0tty->rx_bytes);
+	u64 tx_rate = 0;
+	u64 rx_rate = 0;
+	u64 usecs;
+
+	spin_lock(&tty0tty->stats_lock);
+	usecs = div_u64(now - tty0tty->stats_time, NSEC_PER_USEC);
+	if (tty0tty->stats_time && usecs) {
+		if (tx >= tty0tty->stats_tx)
+			tx_rate = div64_u64((tx - tty0tty->stats_tx) * USEC_PER_SEC, usecs);
+		if (rx >= tty0tty->stats_rx)
+			rx_rate = div64_u64((rx - tty0tty->stats_rx) * USEC_PER_SEC, usecs);
+	}
+	tty0tty->stats_time = now;
+	tty0tty->stats_tx = tx;
+	tty0tty->stats_rx = rx;
+	spin_unlock(&tty0tty->stats_lock);
+
+	return sprintf(buf,
+		"tx_bytes %llu\n"
+		"rx_bytes %llu\n"
+		"tx_rate %llu\n"
+		"rx_rate %llu\n"
+		"dropped %llu\n"
+		"pushes %llu\n"
+		"overrun %u\n"
+		"buf_overrun %u\n"
+		"frame %u\n"
+		"parity %u\n"
+		"brk %u\n",
+		(unsigned long long)tx, (unsigned long long)rx,
+		(unsigned long long)tx_rate, (unsigned long long)rx_rate,
+		(unsigned long long)atomic64_read(&tty0tty->dropped),
+		(unsigned long long)atomic64_read(&tty0tty->pushes),
+		tty0tty->icount.overrun, tty0tty->icount.buf_overrun,
+		tty0tty->icount.frame, tty0tty->icount.parity,
+		tty0tty->icount.brk);
+}
+
+static DEVICE_ATTR_RO(stats);
+
+/*
+ * the attribute 'modem' lists the raised lines of the port, outputs
+ * (DTR RTS) first, then inputs (CTS DSR CD RI). It supports poll(),
+ * every change of a line notifies, so one epoll loop can watch the
+ * handshake of many ports.
+ */
+static ssize_t modem_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	int mcr = READ_ONCE(tty0tty->mcr);
+	int msr = READ_ONCE(tty0tty->msr);
+
+	return sprintf(buf, "%s%s%s%s%s%s\n",
+		(mcr & MCR_DTR) ? "DTR " : "",
+		(mcr & MCR_RTS) ? "RTS " : "",
+		(msr & MSR_CTS) ? "CTS " : "",
+		(msr & MSR_DSR) ? "DSR " : "",
+		(msr & MSR_CD)  ? "CD " : "",
+		(msr & MSR_RI)  ? "RI " : "");
+}
+
+static DEVICE_ATTR_RO(modem);
+
+static void tty0tty_notify_modem(struct tty0tty_serial *tty0tty)
+{
+	struct device *dev = READ_ONCE(tty0tty->dev);
+
+	if (dev)
+		sysfs_notify(&dev->kobj, NULL, "modem");
+}
+
+/*
+ * fault injection on the data sent by the port: 'fault_rate' is the
+ * number of bytes per million that get a fault, 'fault_mode' what
+ * happens to them. The errors are counted in 'stats' of the receiver.
+ */
+static const char * const tty0tty_fault_modes[] = {
+	[TTY0TTY_FAULT_CORRUPT]	= "corrupt",
+	[TTY0TTY_FAULT_DROP]	= "drop",
+	[TTY0TTY_FAULT_PARITY]	= "parity",
+	[TTY0TTY_FAULT_FRAME]	= "frame",
+	[TTY0TTY_FAULT_OVERRUN]	= "overrun",
+};
+
+static ssize_t fault_rate_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", tty0tty->fault_rate);
+}
+
+static ssize_t fault_rate_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || val > 1000000)
+		return -EINVAL;
+
+	WRITE_ONCE(tty0tty->fault_rate, val);
+	return count;
+}
+
+static DEVICE_ATTR_RW(fault_rate);
+
+/* all modes, the selected one in brackets */
+static ssize_t fault_mode_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tty0tty_fault_modes); i++)
+		len += sprintf(buf + len, i == tty0tty->fault_mode ? "[%s] " : "%s ",
+			       tty0tty_fault_modes[i]);
+	buf[len - 1] = '\n';
+	return len;
+}
+
+static ssize_t fault_mode_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tty0tty_fault_modes); i++) {
+		if (sysfs_streq(buf, tty0tty_fault_modes[i])) {
+			WRITE_ONCE(tty0tty->fault_mode, i);
+			return count;
+		}
+	}
+	return -EINVAL;
+}
+
+static DEVICE_ATTR_RW(fault_mode);
+
+/*
+ * the attribute 'strict' (0 or 1) checks the data received by the port
+ * against the frame format of both ends: bytes are cut to the data bits
+ * of the writer and get a parity or framing error where the reader would
+ * sample one, ex: a 7E1 writer to an 8N1 reader.
+ */
+static ssize_t strict_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%i\n", tty0tty->strict);
+}
+
+static ssize_t strict_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	WRITE_ONCE(tty0tty->strict, val ? 1 : 0);
+	tty0tty_build_xlat(tty0tty);
+	return count;
+}
+
+static DEVICE_ATTR_RW(strict);
+
+/*
+ * push coalescing of the data received by the port: with
+ * 'coalesce_usecs' the reader is woken up at most once per window,
+ * or as soon as 'coalesce_bytes' are waiting (0, the default, is no
+ * limit). coalesce_usecs 0 (the default) wakes it up on every write.
+ * The 'pushes' line of 'stats' counts the wakeups.
+ */
+static ssize_t coalesce_usecs_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%llu\n",
+		(unsigned long long)div_u64(tty0tty->coalesce_ns, NSEC_PER_USEC));
+}
+
+static ssize_t coalesce_usecs_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || val > TTY0TTY_COALESCE_MAX_US)
+		return -EINVAL;
+
+	WRITE_ONCE(tty0tty->coalesce_ns, (u64)val * NSEC_PER_USEC);
+	return count;
+}
+
+static DEVICE_ATTR_RW(coalesce_usecs);
+
+static ssize_t coalesce_bytes_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", tty0tty->coalesce_bytes);
+}
+
+static ssize_t coalesce_bytes_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+
+	WRITE_ONCE(tty0tty->coalesce_bytes, val);
+	return count;
+}
+
+static DEVICE_ATTR_RW(coalesce_bytes);
+
+/*
+ * link emulation of the data sent by the port, like netem for a radio
+ * modem or a serial over IP link: 'delay_us' and up to 'jitter_us' more
+ * or less before the data reaches the other side, and 'rate_limit' the
+ * bandwidth of the link in bits per second. All 0 (the default) is a
+ * direct line. The data keeps its order, jitter never reorders bytes.
+ */
+static DEFINE_MUTEX(tty0tty_delay_mutex);	/* allocation of tty0tty->delay */
+
+static ssize_t tty0tty_delay_store(struct tty0tty_serial *tty0tty,
+		unsigned int *field, const char *buf, unsigned int max)
+{
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val) || val > max)
+		return -EINVAL;
+
+	if (val && !tty0tty->delay) {
+		mutex_lock(&tty0tty_delay_mutex);
+		if (!tty0tty->delay)
+			tty0tty->delay = kzalloc(sizeof(*tty0tty->delay), GFP_KERNEL);
+		mutex_unlock(&tty0tty_delay_mutex);
+		if (!tty0tty->delay)
+			return -ENOMEM;
+	}
+
+	WRITE_ONCE(*field, val);
+	WRITE_ONCE(tty0tty->delay_on, tty0tty->delay_us || tty0tty->jitter_us ||
+				      tty0tty->rate_limit);
+	tty0tty_kick(tty0tty);
+	return 0;
+}
+
+static ssize_t delay_us_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", tty0tty->delay_us);
+}
+
+static ssize_t delay_us_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	ssize_t retval;
+
+	retval = tty0tty_delay_store(tty0tty, &tty0tty->delay_us, buf,
+				     TTY0TTY_DELAY_MAX_US);
+	return retval ? retval : count;
+}
+
+static DEVICE_ATTR_RW(delay_us);
+
+static ssize_t jitter_us_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", tty0tty->jitter_us);
+}
+
+static ssize_t jitter_us_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	ssize_t retval;
+
+	retval = tty0tty_delay_store(tty0tty, &tty0tty->jitter_us, buf,
+				     TTY0TTY_DELAY_MAX_US);
+	return retval ? retval : count;
+}
+
+static DEVICE_ATTR_RW(jitter_us);
+
+static ssize_t rate_limit_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", tty0tty->rate_limit);
+}
+
+static ssize_t rate_limit_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	ssize_t retval;
+
+	retval = tty0tty_delay_store(tty0tty, &tty0tty->rate_limit, buf,
+				     UINT_MAX);
+	return retval ? retval : count;
+}
+
+static DEVICE_ATTR_RW(rate_limit);
+
+/*
+ * the attribute 'capture_size' (bytes, 0 is off, the default) records
+ * the traffic of the pair, both directions and the modem lines, in a
+ * ring that 'capture' maps read only. Both ports of a pair share it;
+ * a new size starts a new ring, map it again.
+ */
+static ssize_t capture_size_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	struct tty0tty_capture *cap;
+	unsigned int size = 0;
+
+	rcu_read_lock();
+	cap = rcu_dereference(tty0tty_table[tty0tty->index & ~1].capture);
+	if (cap)
+		size = cap->size;
+	rcu_read_unlock();
+
+	return sprintf(buf, "%u\n", size);
+}
+
+static ssize_t capture_size_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+	struct tty0tty_serial *pair = &tty0tty_table[tty0tty->index & ~1];
+	struct tty0tty_capture *cap = NULL;
+	struct tty0tty_capture *old;
+	unsigned int val;
+
+	if (kstrtouint(buf, 0, &val))
+		return -EINVAL;
+	if (val && (val < TTY0TTY_CAPTURE_MIN || val > TTY0TTY_CAPTURE_MAX))
+		return -EINVAL;
+
+	if (val) {
+		cap = tty0tty_capture_alloc(roundup_pow_of_two(val));
+		if (!cap)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&tty0tty_capture_mutex);
+	old = rcu_dereference_protected(pair->capture,
+			lockdep_is_held(&tty0tty_capture_mutex));
+	rcu_assign_pointer(pair->capture, cap);
+	mutex_unlock(&tty0tty_capture_mutex);
+
+	tty0tty_capture_free(old);
+	return count;
+}
+
+static DEVICE_ATTR_RW(capture_size);
+
+static int capture_mmap(struct file *file, struct kobject *kobj,
+			TTY0TTY_BIN_CONST struct bin_attribute *attr,
+			struct vm_area_struct *vma)
+{
+	struct tty0tty_serial *tty0tty = dev_get_drvdata(kobj_to_dev(kobj));
+	struct tty0tty_capture *cap;
+	int retval = -ENODEV;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	mutex_lock(&tty0tty_capture_mutex);
+	cap = rcu_dereference_protected(tty0tty_table[tty0tty->index & ~1].capture,
+			lockdep_is_held(&tty0tty_capture_mutex));
+	if (cap)
+		retval = remap_vmalloc_range(vma, cap->hdr, vma->vm_pgoff);
+	mutex_unlock(&tty0tty_capture_mutex);
+
+	return retval;
+}
+
+static TTY0TTY_BIN_CONST struct bin_attribute bin_attr_capture = {
+	.attr	= { .name = "capture", .mode = 0400 },
+	.mmap	= capture_mmap,
+};
+
+static struct attribute *tty0tty_dev_attrs[] = {
+	&dev_attr_baudrate.attr,
+	&dev_attr_pacing.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_modem.attr,
+	&dev_attr_fault_rate.attr,
+	&dev_attr_fault_mode.attr,
+	&dev_attr_strict.attr,
+	&dev_attr_coalesce_usecs.attr,
+	&dev_attr_coalesce_bytes.attr,
+	&dev_attr_capture_size.attr,
+	&dev_attr_delay_us.attr,
+	&dev_attr_jitter_us.attr,
+	&dev_attr_rate_limit.attr,
+	NULL
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+static const struct bin_attribute *const tty0tty_dev_bin_attrs[] = {
+#else
+static struct bin_attribute *tty0tty_dev_bin_attrs[] = {
+#endif
+	&bin_attr_capture,
+	NULL
+};
+
+static const struct attribute_group tty0tty_dev_group = {
+	.attrs		= tty0tty_dev_attrs,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0)
+	.bin_attrs_new	= tty0tty_dev_bin_attrs,
+#else
+	.bin_attrs	= tty0tty_dev_bin_attrs,
+#endif
+};
+
+static const struct attribute_group *tty0tty_dev_groups[] = {
+	&tty0tty_dev_group,
+	NULL
+};
+
+
+/*
+ * the open peer of a pair, NULL when closed, when either end is on a
+ * bus or star, in loopback (MCR_LOOP) or taken over by /dev/tntdN.
+ *
+ * A port publishes itself in the peer field of the other end on its
+ * first open and unpublishes itself on its last close, then waits for
+ * a grace period before flushing: data paths that look it up inside
+ * rcu_read_lock() can deliver to it until rcu_read_unlock(). The table
+ * is never freed, the modem line paths use the result without one.
+ */
+static struct tty0tty_serial *get_shadow_tty(int index)
+{
+	struct tty0tty_serial *shadow = NULL;
+	struct tty0tty_serial *peer;
+	int shadow_idx = index ^ 1;
+
+	if (index >= tty0tty_minors)
+		return NULL;
+
+	rcu_read_lock();
+	peer = rcu_dereference(tty0tty_table[index].peer);
+	rcu_read_unlock();
+
+	if (peer &&
+		!rcu_access_pointer(tty0tty_table[index].group) &&
+		!rcu_access_pointer(tty0tty_table[shadow_idx].group) &&
+		!((READ_ONCE(tty0tty_table[index].mcr) |
+		   READ_ONCE(tty0tty_table[shadow_idx].mcr)) & MCR_LOOP) &&
+		!test_bit(TTY0TTY_WIRE, &tty0tty_table[index].flags) &&
+		!test_bit(TTY0TTY_WIRE, &tty0tty_table[shadow_idx].flags)) {
+		shadow = peer;
+#ifdef SCULL_DEBUG
+		printk(KERN_DEBUG "%s - shadow idx: %d\n", __FUNCTION__, shadow_idx);
+#endif
+	}
+
+	return shadow;
+}
+
+/* modem inputs raised by the outputs in mcr, null modem wiring */
+static int tty0tty_mcr_to_msr(int mcr)
+{
+	return ((mcr & MCR_RTS) ? MSR_CTS : 0) |
+	       ((mcr & MCR_DTR) ? MSR_DSR | MSR_CD : 0);
+}
+
+/*
+ * set the modem inputs of shadow, counting and signalling the changes.
+ * With from, they follow its outputs, read under our msr_lock: of two
+ * updates of from->mcr at once the last one sets the lines.
+ */
+static void __tty0tty_set_msr(struct tty0tty_serial *shadow, int msr,
+		struct tty0tty_serial *from)
+{
+	unsigned long flags;
+	int changed;
+	int cts_up;
+
+	spin_lock_irqsave(&shadow->msr_lock, flags);
+	if (from)
+		msr = tty0tty_mcr_to_msr(READ_ONCE(from->mcr));
+	changed = shadow->msr ^ msr;
+
+	if (changed & MSR_CTS)
+		shadow->icount.cts++;
+
+	if (changed & MSR_DSR)
+		shadow->icount.dsr++;
+
+	if (changed & MSR_CD)
+		shadow->icount.dcd++;
+
+	if (changed & MSR_RI)
+		shadow->icount.rng++;
+
+	cts_up = (changed & MSR_CTS) && (msr & MSR_CTS);
+	WRITE_ONCE(shadow->msr, msr);
+	spin_unlock_irqrestore(&shadow->msr_lock, flags);
+
+	/* the counters are visible before TIOCMIWAIT rechecks them */
+	if (changed) {
+		trace_tty0tty_modem(shadow->index, shadow->mcr, msr);
+		wake_up_interruptible(&shadow->wait);
+		tty0tty_notify_modem(shadow);
+	}
+
+	/* the peer may be holding data for our RTS */
+	if (cts_up)
+		tty0tty_kick(shadow);
+}
+
+static void tty0tty_set_msr(struct tty0tty_serial *shadow, int msr)
+{
+	__tty0tty_set_msr(shadow, msr, NULL);
+}
+
+/* null modem: the inputs of shadow are the outputs of from */
+static void tty0tty_follow_mcr(struct tty0tty_serial *shadow,
+		struct tty0tty_serial *from)
+{
+	__tty0tty_set_msr(shadow, 0, from);
+}
+
+static void tty0tty_update_shadow_msr(int index, int msr)
+{
+	struct tty0tty_serial *shadow;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s - 0x%02x\n", __FUNCTION__, msr);
+#endif
+
+	if ((shadow = get_shadow_tty(index)) != NULL)
+		tty0tty_set_msr(shadow, msr);
+}
+
+/* who receives what tty0tty sends: itself in loopback, else the open peer */
+static struct tty0tty_serial *tty0tty_dest(struct tty0tty_serial *tty0tty)
+{
+	if (READ_ONCE(tty0tty->mcr) & MCR_LOOP)
+		return tty0tty;
+	return get_shadow_tty(tty0tty->index);
+}
+
+/* free space, the ring may be over a limit lowered with setserial */
+static unsigned int tty0tty_ring_room(struct tty0tty_ring *ring)
+{
+	unsigned int used = ring->head - smp_load_acquire(&ring->tail);
+	unsigned int limit = READ_ONCE(ring->limit);
+
+	return limit > used ? limit - used : 0;
+}
+
+static unsigned int tty0tty_ring_put(struct tty0tty_ring *ring,
+		const unsigned char *buf, unsigned int count)
+{
+	unsigned int head = ring->head;
+	unsigned int room = tty0tty_ring_room(ring);
+	unsigned int off = head & (ring->size - 1);
+	unsigned int n;
+
+	if (count > room)
+		count = room;
+
+	n = min(count, ring->size - off);
+	memcpy(ring->buf + off, buf, n);
+	memcpy(ring->buf, buf + n, count - n);
+
+	smp_store_release(&ring->head, head + count);
+	return count;
+}
+
+/* returns the length of the contiguous block available at *data */
+static unsigned int tty0tty_ring_peek(struct tty0tty_ring *ring,
+		unsigned char **data)
+{
+	unsigned int tail = ring->tail;
+	unsigned int off = tail & (ring->size - 1);
+
+	*data = ring->buf + off;
+	return min(smp_load_acquire(&ring->head) - tail, ring->size - off);
+}
+
+static void tty0tty_ring_consume(struct tty0tty_ring *ring, unsigned int count)
+{
+	smp_store_release(&ring->tail, ring->tail + count);
+}
+
+static int tty0tty_ring_empty(struct tty0tty_ring *ring)
+{
+	return smp_load_acquire(&ring->head) == ring->tail;
+}
+
+static unsigned int tty0tty_ring_used(struct tty0tty_ring *ring)
+{
+	return smp_load_acquire(&ring->head) - smp_load_acquire(&ring->tail);
+}
+
+/* data or a break waiting to be sent */
+static int tty0tty_tx_pending(struct tty0tty_serial *tty0tty)
+{
+	return !tty0tty_ring_empty(&tty0tty->xmit) ||
+	       test_bit(TTY0TTY_BREAK, &tty0tty->flags);
+}
+
+/*
+ * Flow control: data waits in xmit while the peer line discipline is
+ * throttled or, with CRTSCTS, while the peer holds RTS (our CTS) low.
+ * Both conditions end with a tty0tty_kick(), no polling needed.
+ */
+static int tty0tty_tx_blocked(struct tty0tty_serial *tty0tty)
+{
+	struct tty0tty_serial *shadow = tty0tty_dest(tty0tty);
+
+	/* xmit is read by /dev/tntdN */
+	if (test_bit(TTY0TTY_WIRE, &tty0tty->flags))
+		return 1;
+
+	if (shadow == NULL)
+		return 0;	/* not blocked, the data is dropped or on a bus */
+
+	if (test_bit(TTY0TTY_THROTTLED, &shadow->flags))
+		return 1;
+
+	return tty0tty->crtscts && !(READ_ONCE(tty0tty->msr) & MSR_CTS);
+}
+
+/* room for the mark of one more write */
+static int tty0tty_delay_full(struct tty0tty_serial *tty0tty)
+{
+	struct tty0tty_delay *d = tty0tty->delay;
+
+	return d->head - smp_load_acquire(&d->tail) >= TTY0TTY_DELAY_MARKS;
+}
+
+/*
+ * Mark count bytes written at xmit position start, called by the
+ * producer. They go on the link when it is free, take count * 8 bits
+ * at rate_limit to cross it, then delay_us +- jitter_us to arrive.
+ */
+static void tty0tty_delay_mark(struct tty0tty_serial *tty0tty,
+		unsigned int start, unsigned int count)
+{
+	struct tty0tty_delay *d = tty0tty->delay;
+	struct tty0tty_mark *m = &d->mark[d->head & (TTY0TTY_DELAY_MARKS - 1)];
+	unsigned int rate = READ_ONCE(tty0tty->rate_limit);
+	unsigned int jitter = READ_ONCE(tty0tty->jitter_us);
+	u64 delay = (u64)READ_ONCE(tty0tty->delay_us) * NSEC_PER_USEC;
+	u64 sent = ktime_get_ns();
+
+	if (rate) {
+		if (d->link_free > sent)
+			sent = d->link_free;
+		sent += div_u64((u64)count * 8 * NSEC_PER_SEC, rate);
+		d->link_free = sent;
+	}
+
+	if (jitter) {
+		delay += (u64)(get_random_u32() % (2 * jitter + 1)) * NSEC_PER_USEC;
+		delay = delay > (u64)jitter * NSEC_PER_USEC ?
+			delay - (u64)jitter * NSEC_PER_USEC : 0;
+	}
+
+	m->start = start;
+	m->end = start + count;
+	m->release = max(sent + delay, d->last_release);
+	d->last_release = m->release;
+	smp_store_release(&d->head, d->head + 1);
+}
+
+/*
+ * Bytes of xmit that reached the far end of the link, called with
+ * TTY0TTY_DRAINING held. delay_timer is armed for the next mark, one
+ * timer per port whatever the data in flight. The timer can fire before
+ * the caller drops TTY0TTY_DRAINING and lose it, TTY0TTY_DELAY_DUE then
+ * tells the caller to look again.
+ */
+static unsigned int tty0tty_delay_ready(struct tty0tty_serial *tty0tty)
+{
+	struct tty0tty_delay *d = tty0tty->delay;
+	unsigned int tail = tty0tty->xmit.tail;
+	struct tty0tty_mark *m;
+	u64 now = ktime_get_ns();
+
+	while (d->tail != smp_load_acquire(&d->head)) {
+		m = &d->mark[d->tail & (TTY0TTY_DELAY_MARKS - 1)];
+
+		/* flushed or read by /dev/tntdN are gone too */
+		if ((int)(m->end - tail) > 0 && m->release > now) {
+			hrtimer_start(&tty0tty->delay_timer,
+				      ns_to_ktime(m->release), HRTIMER_MODE_ABS);
+			return (int)(m->start - tail) > 0 ? m->start - tail : 0;
+		}
+		smp_store_release(&d->tail, d->tail + 1);
+	}
+	return UINT_MAX;
+}
+
+static void tty0tty_lat_record(u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+	unsigned int bucket = ns ? ilog2(ns) + 1 : 0;
+
+	this_cpu_inc(tty0tty_lat_hist.count[min_t(unsigned int, bucket,
+						  TTY0TTY_LAT_BUCKETS - 1)]);
+}
+
+/*
+ * Slow path of tty0tty_deliver() while fault injection is on, each byte
+ * gets a fault with a probability of fault_rate per million. Returns
+ * the bytes taken from data, *sent counts those put in the flip buffer.
+ */
+static unsigned int tty0tty_insert_faults(struct tty0tty_serial *tty0tty,
+		struct tty0tty_serial *shadow, const unsigned char *data,
+		unsigned int count, unsigned int *sent)
+{
+	const struct tty0tty_xlat *xlat = rcu_dereference(shadow->rx_xlat);
+	unsigned int rate = READ_ONCE(tty0tty->fault_rate);
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		unsigned char ch = data[i];
+		char flag = tty0tty->rx_flag;
+
+		if (xlat) {
+			flag = xlat->flag[ch];
+			ch = xlat->ch[ch];
+		}
+
+		if (get_random_u32() % 1000000 < rate) {
+			switch (READ_ONCE(tty0tty->fault_mode)) {
+			case TTY0TTY_FAULT_CORRUPT:
+				ch ^= 1 << (get_random_u32() & 7);
+				break;
+			case TTY0TTY_FAULT_DROP:
+				continue;
+			case TTY0TTY_FAULT_PARITY:
+				flag = TTY_PARITY;
+				shadow->icount.parity++;
+				break;
+			case TTY0TTY_FAULT_FRAME:
+				flag = TTY_FRAME;
+				shadow->icount.frame++;
+				break;
+			case TTY0TTY_FAULT_OVERRUN:
+				flag = TTY_OVERRUN;
+				shadow->icount.overrun++;
+				break;
+			}
+		}
+
+		if (!tty_insert_flip_char(&shadow->port, ch, flag))
+			break;
+		(*sent)++;
+	}
+	return i;
+}
+
+/* delivery in strict mode, bytes go through the table of the reader */
+static unsigned int tty0tty_insert_xlat(struct tty0tty_serial *shadow,
+		const struct tty0tty_xlat *xlat, const unsigned char *data,
+		unsigned int count)
+{
+	unsigned char ch[64];
+	char flag[64];
+	unsigned int done = 0;
+	unsigned int len, n, i;
+
+	while (done < count) {
+		len = min_t(unsigned int, count - done, sizeof(ch));
+		for (i = 0; i < len; i++) {
+			ch[i] = xlat->ch[data[done + i]];
+			flag[i] = xlat->flag[data[done + i]];
+		}
+
+		n = tty_insert_flip_string_flags(&shadow->port, ch, flag, len);
+		for (i = 0; i < n; i++) {
+			if (flag[i] == TTY_PARITY)
+				shadow->icount.parity++;
+			else if (flag[i] == TTY_FRAME)
+				shadow->icount.frame++;
+		}
+
+		done += n;
+		if (n < len)
+			break;
+	}
+	return done;
+}
+
+/*
+ * called with rx_lock held, the data reaches the reader here: the trace
+ * and the write to push latency are taken now, not when it was put in
+ * the flip buffer, a coalesced push counts its whole wait.
+ */
+static void tty0tty_push_now(struct tty0tty_serial *tty0tty)
+{
+	tty_flip_buffer_push(&tty0tty->port);
+	trace_tty0tty_push(tty0tty->push_from, tty0tty->index, tty0tty->push_bytes);
+	if (tty0tty->push_start) {
+		tty0tty_lat_record(tty0tty->push_start);
+		tty0tty->push_start = 0;
+	}
+	tty0tty->push_bytes = 0;
+	atomic64_inc(&tty0tty->pushes);
+}
+
+/*
+ * Push count more bytes received by tty0tty from the port from (NULL
+ * for /dev/tntdN) to its line discipline, called with rx_lock held.
+ * With coalesce_usecs, or without ASYNC_LOW_LATENCY, the push waits for
+ * push_timer or coalesce_bytes, a chatty writer then wakes up the reader
+ * once per window instead of once per write.
+ */
+static void tty0tty_push(struct tty0tty_serial *tty0tty,
+		struct tty0tty_serial *from, unsigned int count)
+{
+	u64 window = READ_ONCE(tty0tty->coalesce_ns);
+	unsigned int bytes = READ_ONCE(tty0tty->coalesce_bytes);
+
+	if (!window && !READ_ONCE(tty0tty->low_latency))
+		window = TTY0TTY_PUSH_DELAY_NS;
+
+	tty0tty->push_bytes += count;
+	tty0tty->push_from = from ? from->index : -1;
+	if (from && !tty0tty->push_start)
+		tty0tty->push_start = READ_ONCE(from->lat_start);
+	if (!window || (bytes && tty0tty->push_bytes >= bytes)) {
+		tty0tty_push_now(tty0tty);
+		return;
+	}
+
+	if (!test_and_set_bit(TTY0TTY_PUSH, &tty0tty->flags))
+		hrtimer_start(&tty0tty->push_timer, ns_to_ktime(window),
+			      HRTIMER_MODE_REL);
+}
+
+static enum hrtimer_restart tty0tty_push_timer(struct hrtimer *timer)
+{
+	struct tty0tty_serial *tty0tty =
+		container_of(timer, struct tty0tty_serial, push_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tty0tty->rx_lock, flags);
+	clear_bit(TTY0TTY_PUSH, &tty0tty->flags);
+	/* coalesce_bytes may have pushed it already */
+	if (tty0tty->push_bytes)
+		tty0tty_push_now(tty0tty);
+	spin_unlock_irqrestore(&tty0tty->rx_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/* does member i of group receive what the port index sends */
+static int tty0tty_group_dest(const struct tty0tty_group *group,
+		unsigned int index, unsigned int i)
+{
+	if (group->member[i] == index)
+		return 0;
+	if (group->mode == TTY0TTY_TOPO_STAR)
+		return i == 0 || group->member[0] == index;
+	return 1;
+}
+
+/*
+ * Bus and star delivery, called with TTY0TTY_DRAINING held: each block
+ * of xmit goes to the flip buffer of every destination in one pass over
+ * the member list. Nothing waits, a member that is closed, throttled or
+ * full loses the block like a slow node on a real RS-485 bus, and counts
+ * an overrun. Flow control, modem lines, strict mode and fault injection
+ * are pair only.
+ */
+static unsigned int tty0tty_deliver_group(struct tty0tty_serial *tty0tty,
+		unsigned int limit)
+{
+	const struct tty0tty_group *group;
+	struct tty0tty_serial *dst;
+	unsigned char *data;
+	unsigned int count, done = 0;
+	unsigned int i, n;
+	unsigned long flags;
+	int brk;
+
+	rcu_read_lock();
+	group = rcu_dereference(tty0tty->group);
+	while (group) {
+		count = tty0tty_ring_peek(&tty0tty->xmit, &data);
+		count = min(count, limit - done);
+		brk = 0;
+		if (!count) {
+			/* a break follows the data written before it */
+			if (!tty0tty_ring_empty(&tty0tty->xmit) ||
+			    !test_and_clear_bit(TTY0TTY_BREAK, &tty0tty->flags))
+				break;
+			brk = 1;
+		}
+
+		for (i = 0; i < group->count; i++) {
+			if (!tty0tty_group_dest(group, tty0tty->index, i))
+				continue;
+			/*
+			 * Open members are published like the peer of a pair,
+			 * their last close waits for rcu_read_unlock().
+			 */
+			dst = rcu_dereference(tty0tty_table[group->member[i] ^ 1].peer);
+			if (!dst)
+				continue;
+
+			spin_lock_irqsave(&dst->rx_lock, flags);
+			if (test_bit(TTY0TTY_THROTTLED, &dst->flags))
+				n = 0;
+			else if (brk)
+				n = tty_insert_flip_char(&dst->port, 0, TTY_BREAK);
+			else
+				n = tty_insert_flip_string(&dst->port, data, count);
+			if (n)
+				tty0tty_push(dst, tty0tty, n);
+			if (n < count + brk)
+				dst->icount.overrun++;
+			else if (brk)
+				dst->icount.brk++;
+			spin_unlock_irqrestore(&dst->rx_lock, flags);
+
+			if (!brk)
+				atomic64_add(n, &dst->rx_bytes);
+		}
+
+		if (brk)
+			break;
+		tty0tty_ring_consume(&tty0tty->xmit, count);
+		done += count;
+	}
+	rcu_read_unlock();
+
+	/* the members have the start of the latency in their push_start */
+	if (done)
+		tty0tty->lat_start = 0;
+
+	atomic64_add(done, &tty0tty->tx_bytes);
+	return done;
+}
+
+/*
+ * Move up to limit bytes of xmit to the peer flip buffer, called with
+ * TTY0TTY_DRAINING held. Returns the bytes taken from xmit, *stall
+ * tells why it stopped before limit with data left.
+ */
+static unsigned int tty0tty_deliver(struct tty0tty_serial *tty0tty,
+		unsigned int limit, int *stall)
+{
+	struct tty0tty_serial *peer;
+	struct tty_port *port;
+	struct tty0tty_serial *shadow;
+	unsigned char *data;
+	unsigned int count;
+	const struct tty0tty_xlat *xlat = NULL;
+	unsigned int done = 0;
+	unsigned int sent = 0;
+	int brk = 0;
+	unsigned long flags;
+
+	*stall = 0;
+	if (test_and_clear_bit(TTY0TTY_FLUSH, &tty0tty->flags)) {
+		count = tty0tty_ring_used(&tty0tty->xmit);
+		tty0tty_ring_consume(&tty0tty->xmit, count);
+		atomic64_add(count, &tty0tty->dropped);
+	}
+
+	/* link emulation, the data not arrived yet waits in xmit */
+	if (unlikely(READ_ONCE(tty0tty->delay_on))) {
+		limit = min(limit, tty0tty_delay_ready(tty0tty));
+		if (!limit) {
+			*stall = TTY0TTY_STALL_DELAY;
+			return 0;
+		}
+	}
+
+	if (rcu_access_pointer(tty0tty->group))
+		return tty0tty_deliver_group(tty0tty, limit);
+
+	if (tty0tty_tx_blocked(tty0tty)) {
+		*stall = TTY0TTY_STALL_BLOCKED;
+		return 0;
+	}
+
+	/* the peer can not finish closing before rcu_read_unlock() */
+	rcu_read_lock();
+
+	/* in loopback the data comes back to the port itself */
+	shadow = tty0tty_dest(tty0tty);
+	peer = shadow == tty0tty ? tty0tty : &tty0tty_table[tty0tty->index ^ 1];
+	port = &peer->port;
+
+	spin_lock_irqsave(&peer->rx_lock, flags);
+	if (shadow != NULL && shadow != tty0tty)
+		xlat = rcu_dereference(shadow->rx_xlat);
+
+	while (done < limit &&
+	       (count = tty0tty_ring_peek(&tty0tty->xmit, &data)) > 0) {
+		unsigned int n;
+
+		count = min(count, limit - done);
+		n = count;
+
+		/* nobody listening, a null modem loses the data */
+		if (shadow != NULL && unlikely(READ_ONCE(tty0tty->fault_rate))) {
+			n = tty0tty_insert_faults(tty0tty, shadow, data, count, &sent);
+		} else if (shadow != NULL && xlat) {
+			n = tty0tty_insert_xlat(shadow, xlat, data, count);
+			sent += n;
+		} else if (shadow != NULL) {
+			if (tty0tty->rx_flag != TTY_NORMAL)
+				n = tty_insert_flip_string_fixed_flag(port, data,
+						tty0tty->rx_flag, count);
+			else
+				n = tty_insert_flip_string(port, data, count);
+			sent += n;
+		}
+
+		tty0tty_ring_consume(&tty0tty->xmit, n);
+		done += n;
+		if (n < count) {
+			/* the peer flip buffer is full, the data waits in xmit */
+			shadow->icount.buf_overrun++;
+			*stall = TTY0TTY_STALL_FULL;
+			break;
+		}
+	}
+
+	/* a break follows the data written before it */
+	if (!*stall && tty0tty_ring_empty(&tty0tty->xmit) &&
+	    test_and_clear_bit(TTY0TTY_BREAK, &tty0tty->flags) && shadow != NULL) {
+		if (tty_insert_flip_char(port, 0, TTY_BREAK)) {
+			shadow->icount.brk++;
+			brk = 1;
+		} else {
+			set_bit(TTY0TTY_BREAK, &tty0tty->flags);
+			*stall = TTY0TTY_STALL_FULL;
+		}
+	}
+
+	if (sent || brk)
+		tty0tty_push(peer, tty0tty, sent + brk);
+	spin_unlock_irqrestore(&peer->rx_lock, flags);
 
-static int kernel_termios_to_user_termios(struct termios2 __user *u,
-						 struct ktermios *k)
-{
-	return copy_to_user(u, k, sizeof(struct termios2));
+	/* the peer took data, a full flip buffer is retried soon again */
+	if (done || brk)
+		WRITE_ONCE(tty0tty->retry_delay, 1);
+
+	if (sent || brk) {
+		atomic64_add(sent, &tty0tty->tx_bytes);
+		atomic64_add(sent, &shadow->rx_bytes);
+	}
+	rcu_read_unlock();
+
+	/* the peer has the start of the latency in its push_start */
+	if (done)
+		tty0tty->lat_start = 0;
+
+	if (done > sent)
+		atomic64_add(done - sent, &tty0tty->dropped);
+
+	return done;
 }
-static int user_termios_to_kernel_termios_1(struct ktermios *k,
-						   struct termios __user *u)
+
+static void tty0tty_pace_start(struct tty0tty_serial *tty0tty);
+
+/*
+ * The peer flip buffer is full but its line discipline did not throttle,
+ * so no kick will come when it drains: poll it, backing off from one
+ * jiffy to TTY0TTY_RETRY_MAX while it takes nothing.
+ */
+static void tty0tty_retry_later(struct tty0tty_serial *tty0tty)
 {
-	return copy_from_user(k, u, sizeof(struct termios));
+	unsigned long delay = READ_ONCE(tty0tty->retry_delay);
+
+	WRITE_ONCE(tty0tty->retry_delay, min(delay * 2, (unsigned long)TTY0TTY_RETRY_MAX));
+	schedule_delayed_work(&tty0tty->retry, delay);
 }
 
-static int kernel_termios_to_user_termios_1(struct termios __user *u,
-						   struct ktermios *k)
+/* a reader of /dev/tntdN may be waiting to consume xmit */
+static void tty0tty_drain_unlock(struct tty0tty_serial *tty0tty)
 {
-	return copy_to_user(u, k, sizeof(struct termios));
+	clear_bit_unlock(TTY0TTY_DRAINING, &tty0tty->flags);
+	if (test_bit(TTY0TTY_WIRE, &tty0tty->flags))
+		wake_up_interruptible(&tty0tty->wire_wait);
 }
-#endif
-
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
-int tty_check_change(struct tty_struct *tty);
-speed_t tty_termios_input_baud_rate(struct ktermios *termios);
-#else
-#ifndef tty_alloc_driver
-#define tty_alloc_driver(x, y) alloc_tty_driver(x)
-#endif
-#define tty_driver_kref_put(x) put_tty_driver(x)
-#endif
-
-#define DRIVER_VERSION "v1.4"
-#define DRIVER_AUTHOR "Luis Claudio Gamboa Lopes <lcgamboa@yahoo.com>"
-#define DRIVER_DESC "tty0tty null modem driver"
-
-/* Module information */
-MODULE_AUTHOR(DRIVER_AUTHOR);
-MODULE_DESCRIPTION(DRIVER_DESC);
-MODULE_LICENSE("GPL");
 
+/*
+ * Move pending xmit data to the peer. Whoever wins TTY0TTY_DRAINING
+ * does the work, a loser only has to make sure the winner sees its
+ * data, which the recheck after the unlock does. What the peer can
+ * not take stays in xmit and is retried from tty0tty_retry_work(),
+ * which also wakes up the writer.
+ */
+static void tty0tty_drain(struct tty0tty_serial *tty0tty)
+{
+	int stall;
 
-#define TTY0TTY_MAJOR		0	/* dynamic allocation of major number */
-#define TTY0TTY_MINORS		8	/* device number, always even*/
+	if (READ_ONCE(tty0tty->pacing) && READ_ONCE(tty0tty->char_ns) &&
+	    !test_bit(TTY0TTY_FLUSH, &tty0tty->flags)) {
+		tty0tty_pace_start(tty0tty);
+		return;
+	}
 
-/* fake UART values */
-//out
-#define MCR_DTR		0x01
-#define MCR_RTS		0x02
-#define MCR_LOOP	0x04
-//in
-#define MSR_CTS		0x10
-#define MSR_CD		0x20
-#define MSR_DSR		0x40
-#define MSR_RI		0x80
+	do {
+		if (test_and_set_bit(TTY0TTY_DRAINING, &tty0tty->flags))
+			return;
 
+		/* a delay_timer that fires from now on is seen below */
+		clear_bit(TTY0TTY_DELAY_DUE, &tty0tty->flags);
+		tty0tty_deliver(tty0tty, UINT_MAX, &stall);
+
+		tty0tty_drain_unlock(tty0tty);
+		smp_mb();
+	} while ((stall != TTY0TTY_STALL_FULL && stall != TTY0TTY_STALL_DELAY &&
+		  (test_bit(TTY0TTY_FLUSH, &tty0tty->flags) ||
+		   (tty0tty_tx_pending(tty0tty) &&
+		    !tty0tty_tx_blocked(tty0tty)))) ||
+		 (stall == TTY0TTY_STALL_DELAY &&
+		  test_bit(TTY0TTY_DELAY_DUE, &tty0tty->flags)));
+
+	if (stall == TTY0TTY_STALL_FULL)
+		tty0tty_retry_later(tty0tty);
+}
 
-static struct tty_port tport[TTY0TTY_MINORS];
+/*
+ * Pacing: the timer releases the characters whose line time has
+ * elapsed since pace_next, in batches of TTY0TTY_PACE_BATCH_NS so a
+ * fast port does not take one interrupt per character. The timer runs
+ * while TTY0TTY_PACING is set and there is data to send.
+ */
+static void tty0tty_pace_start(struct tty0tty_serial *tty0tty)
+{
+	u64 now;
 
-struct tty0tty_serial {
-	struct tty_struct	*tty;		/* pointer to the tty for this device */
-	int			open_count;	/* number of times this port has been opened */
-	struct semaphore	sem;		/* locks this structure */
+	if (test_and_set_bit(TTY0TTY_PACING, &tty0tty->flags))
+		return;
 
-	/* for tiocmget and tiocmset functions */
-	int			msr;		/* MSR shadow */
-	int			mcr;		/* MCR shadow */
+	/* an idle line starts sending now */
+	now = ktime_to_ns(ktime_get());
+	if (tty0tty->pace_next < now)
+		tty0tty->pace_next = now;
 
-	/* for ioctl fun */
-	struct serial_struct	serial;
-	wait_queue_head_t	wait;
-	struct async_icount	icount;
-};
+	hrtimer_start(&tty0tty->pace_timer,
+		ns_to_ktime(tty0tty->pace_next + tty0tty->char_ns),
+		HRTIMER_MODE_ABS);
+}
 
-static struct tty0tty_serial *tty0tty_table[TTY0TTY_MINORS];	/* initially all NULL */
+static enum hrtimer_restart tty0tty_pace_timer(struct hrtimer *timer)
+{
+	struct tty0tty_serial *tty0tty =
+		container_of(timer, struct tty0tty_serial, pace_timer);
+	u64 char_ns = READ_ONCE(tty0tty->char_ns);
+	u64 now = ktime_to_ns(ktime_get());
+	unsigned int budget = UINT_MAX;
+	unsigned int done;
+	int stall = 0;
+
+	if (char_ns)
+		budget = now > tty0tty->pace_next ? min_t(u64, UINT_MAX,
+			div64_u64(now - tty0tty->pace_next, char_ns)) : 0;
+
+	if (budget && !test_and_set_bit(TTY0TTY_DRAINING, &tty0tty->flags)) {
+		clear_bit(TTY0TTY_DELAY_DUE, &tty0tty->flags);
+		done = tty0tty_deliver(tty0tty, budget, &stall);
+		tty0tty_drain_unlock(tty0tty);
+
+		tty0tty->pace_next += done * char_ns;
+		if (done && tty0tty_ring_used(&tty0tty->xmit) < TTY0TTY_WAKEUP_CHARS)
+			tty_port_tty_wakeup(&tty0tty->port);
+	}
 
+	if (stall == TTY0TTY_STALL_FULL)
+		tty0tty_retry_later(tty0tty);
+	else if (stall != TTY0TTY_STALL_DELAY && tty0tty_tx_pending(tty0tty) &&
+		 !tty0tty_tx_blocked(tty0tty))
+		goto restart;
+
+	clear_bit(TTY0TTY_PACING, &tty0tty->flags);
+	smp_mb();
+
+	/* a writer or delay_timer may have seen the timer still running */
+	if (((stall != TTY0TTY_STALL_FULL && stall != TTY0TTY_STALL_DELAY &&
+	      tty0tty_tx_pending(tty0tty) &&
+	      !tty0tty_tx_blocked(tty0tty)) ||
+	     (stall == TTY0TTY_STALL_DELAY &&
+	      test_bit(TTY0TTY_DELAY_DUE, &tty0tty->flags))) &&
+	    !test_and_set_bit(TTY0TTY_PACING, &tty0tty->flags))
+		goto restart;
+
+	if (test_bit(TTY0TTY_FLUSH, &tty0tty->flags))
+		tty0tty_drain(tty0tty);
+
+	return HRTIMER_NORESTART;
+
+restart:
+	hrtimer_set_expires(timer, ns_to_ktime(tty0tty->pace_next +
+		max_t(u64, char_ns, TTY0TTY_PACE_BATCH_NS)));
+	return HRTIMER_RESTART;
+}
 
+/* the next write reached the far end of the link */
+static enum hrtimer_restart tty0tty_delay_timer(struct hrtimer *timer)
+{
+	struct tty0tty_serial *tty0tty =
+		container_of(timer, struct tty0tty_serial, delay_timer);
 
-/*attributes*/
+	/* whoever holds TTY0TTY_DRAINING drains again, see tty0tty_delay_ready() */
+	set_bit(TTY0TTY_DELAY_DUE, &tty0tty->flags);
+	tty0tty_drain(tty0tty);
+	/* the writer may wait for a mark */
+	tty_port_tty_wakeup(&tty0tty->port);
 
-/*
- * /sys/device/virtual/tty/tntx/
- *
- * the attribute 'baudrate' contains the baudrate of virtual serial 
- * port (return 0 if port is not open) and it supports poll() 
- * to detect when value is changed.
- */
-static struct device *tty0tty_dev[TTY0TTY_MINORS];
+	return HRTIMER_NORESTART;
+}
 
-/* Sysfs attribute */
-static ssize_t baudrate_show(struct device *dev,
-			    struct device_attribute *attr, char *buf){
-	int baud = 0;
-	struct tty0tty_serial *tty0tty = dev_get_drvdata(dev);
+static void tty0tty_retry_work(struct work_struct *work)
+{
+	struct tty0tty_serial *tty0tty =
+		container_of(to_delayed_work(work), struct tty0tty_serial, retry);
 
-#ifdef SCULL_DEBUG
-	printk(KERN_DEBUG "%s \n", __FUNCTION__);
-#endif
+	tty0tty_drain(tty0tty);
+	tty_port_tty_wakeup(&tty0tty->port);
 
-	if (!tty0tty)
-		return sprintf(buf, "%i\n", baud);
+	/* a writer of /dev/tntdN waiting for the flip buffer tries again */
+	if (test_bit(TTY0TTY_WIRE, &tty0tty->flags)) {
+		atomic_inc(&tty0tty->wire_room);
+		wake_up_interruptible(&tty0tty->wire_wait);
+	}
+}
 
-    if (!tty0tty->tty)
-		return sprintf(buf, "%i\n", baud);
+/* drain and wake the writer now, from process context */
+static void tty0tty_kick(struct tty0tty_serial *tty0tty)
+{
+	mod_delayed_work(system_wq, &tty0tty->retry, 0);
+}
 
-    down(&tty0tty->sem);
-	if (tty0tty->open_count) 
-	{
-		baud = tty_get_baud_rate(tty0tty->tty);
+static unsigned int tty0tty_data_bits(unsigned int cflag)
+{
+	switch (cflag & CSIZE) {
+	case CS5:
+		return 5;
+	case CS6:
+		return 6;
+	case CS7:
+		return 7;
+	default:
+		return 8;
 	}
-	up(&tty0tty->sem);
-
-	return sprintf(buf, "%i\n", baud);
 }
 
-static DEVICE_ATTR_RO(baudrate);
+/* the parity bit sent with data, or expected with it */
+static unsigned int tty0tty_parity_bit(unsigned int cflag, unsigned int data)
+{
+	if (cflag & CMSPAR)
+		return (cflag & PARODD) ? 1 : 0;	/* MARK or SPACE */
 
-static struct attribute *tty0tty_dev_attrs[] = {
-	&dev_attr_baudrate.attr,
-	NULL
-};
+	return (hweight8(data) & 1) ^ ((cflag & PARODD) ? 1 : 0);
+}
 
-ATTRIBUTE_GROUPS(tty0tty_dev);
+/*
+ * Fill the table for a writer with tx_cflag and a reader with rx_cflag.
+ * The frame after the start bit is the data bits LSB first, the parity
+ * bit, then stop bits and idle line, all ones. The reader takes its data
+ * bits, its parity bit and checks the first stop bit. Returns 0 when
+ * the table changes nothing.
+ */
+static int tty0tty_fill_xlat(struct tty0tty_xlat *xlat,
+		unsigned int tx_cflag, unsigned int rx_cflag)
+{
+	unsigned int tx_bits = tty0tty_data_bits(tx_cflag);
+	unsigned int rx_bits = tty0tty_data_bits(rx_cflag);
+	unsigned int c, frame, pos;
+	int changed = 0;
+
+	for (c = 0; c < 256; c++) {
+		frame = c & ((1 << tx_bits) - 1);
+		pos = tx_bits;
+		if (tx_cflag & PARENB)
+			frame |= tty0tty_parity_bit(tx_cflag, frame) << pos++;
+		frame |= ~0U << pos;
+
+		xlat->ch[c] = frame & ((1 << rx_bits) - 1);
+		xlat->flag[c] = TTY_NORMAL;
+		pos = rx_bits;
+		if ((rx_cflag & PARENB) &&
+		    ((frame >> pos++) & 1) != tty0tty_parity_bit(rx_cflag, xlat->ch[c]))
+			xlat->flag[c] = TTY_PARITY;
+		else if (!((frame >> pos) & 1))
+			xlat->flag[c] = TTY_FRAME;
+
+		if (xlat->ch[c] != c || xlat->flag[c] != TTY_NORMAL)
+			changed = 1;
+	}
+	return changed;
+}
 
+static DEFINE_SPINLOCK(tty0tty_xlat_lock);	/* serializes rx_xlat updates */
 
-static struct tty0tty_serial *get_shadow_tty(int index)
+/* (re)build the strict mode table of the data received by tty0tty */
+static void tty0tty_build_xlat(struct tty0tty_serial *tty0tty)
 {
-	struct tty0tty_serial *shadow = NULL;
-	int shadow_idx = index ^ 1;
+	struct tty0tty_serial *peer = &tty0tty_table[tty0tty->index ^ 1];
+	struct tty0tty_xlat *xlat = NULL;
+	struct tty0tty_xlat *old;
 
-	if ((index < TTY0TTY_MINORS) &&
-		(tty0tty_table[shadow_idx] != NULL) &&
-		(tty0tty_table[shadow_idx]->open_count > 0)) {
-		shadow = tty0tty_table[shadow_idx];
-#ifdef SCULL_DEBUG
-		printk(KERN_DEBUG "%s - shadow idx: %d\n", __FUNCTION__, shadow_idx);
-#endif
+	if (READ_ONCE(tty0tty->strict))
+		xlat = kmalloc(sizeof(*xlat), GFP_KERNEL);
+
+	spin_lock(&tty0tty_xlat_lock);
+	if (xlat && !tty0tty_fill_xlat(xlat, peer->cflag, tty0tty->cflag)) {
+		kfree(xlat);
+		xlat = NULL;
 	}
+	old = rcu_dereference_protected(tty0tty->rx_xlat,
+			lockdep_is_held(&tty0tty_xlat_lock));
+	rcu_assign_pointer(tty0tty->rx_xlat, xlat);
+	spin_unlock(&tty0tty_xlat_lock);
 
-	return shadow;
+	if (old)
+		kfree_rcu(old, rcu);
 }
 
-static void tty0tty_update_shadow_msr(int index, int msr)
+static void tty0tty_cache_termios(struct tty0tty_serial *tty0tty,
+		struct tty_struct *tty)
 {
-	struct tty0tty_serial *shadow;
+	unsigned int cflag = tty->termios.c_cflag;
+	unsigned int bits;
+	speed_t baud;
 
-#ifdef SCULL_DEBUG
-	printk(KERN_DEBUG "%s - 0x%02x\n", __FUNCTION__, msr);
-#endif
+	if ((cflag & PARENB) && (cflag & CMSPAR) && (cflag & PARODD))
+		tty0tty->rx_flag = TTY_PARITY;	/* MARK parity bit. */
+	else
+		tty0tty->rx_flag = TTY_NORMAL;
 
-	if ((shadow = get_shadow_tty(index)) != NULL) {
-		if((shadow->msr & MSR_CTS) != (msr & MSR_CTS))
-			shadow->icount.cts++;
+	tty0tty->crtscts = (cflag & CRTSCTS) ? 1 : 0;
 
-		if((shadow->msr & MSR_DSR) != (msr & MSR_DSR))
-			shadow->icount.dsr++;
+	/* start + data + parity + stop bits, for pacing */
+	bits = tty0tty_data_bits(cflag);
+	bits += (cflag & PARENB) ? 2 : 1;
+	bits += (cflag & CSTOPB) ? 2 : 1;
 
-		if((shadow->msr & MSR_CD) != (msr & MSR_CD))
-			shadow->icount.dcd++;
+	baud = tty_termios_baud_rate(&tty->termios);
+	tty0tty->char_ns = baud ? div_u64((u64)bits * NSEC_PER_SEC, baud) : 0;
 
-		if (msr != shadow->msr) {
-			shadow->msr = msr;
-			wake_up_interruptible(&shadow->wait);
-		}
-	}
+	/* the strict mode tables of both directions depend on the frame format */
+	tty0tty->cflag = cflag;
+	tty0tty_build_xlat(tty0tty);
+	tty0tty_build_xlat(&tty0tty_table[tty0tty->index ^ 1]);
 }
 
 static int tty0tty_open(struct tty_struct *tty, struct file *file)
@@ -232,47 +1992,75 @@ static int tty0tty_open(struct tty_struct *tty, struct file *file)
 
 	/* get the serial object associated with this tty pointer */
 	index = tty->index;
-	tty0tty = tty0tty_table[index];
-	tport[index].tty=tty;
-	tty->port = &tport[index];
-
-	if ((shadow = get_shadow_tty(index)) != NULL)
-		mcr = shadow->mcr;
-
-//null modem connection
+	tty0tty = &tty0tty_table[index];
+	if (!tty0tty->dev)
+		return -ENODEV;	/* pair not created */
 
-	if( (mcr & MCR_RTS) == MCR_RTS )
-	{
-		msr |= MSR_CTS;
-	}
+	tty_port_tty_set(&tty0tty->port, tty);
+	tty->port = &tty0tty->port;
+	/* the tty may be kept from before a hangup, files still hold it */
+	clear_bit(TTY_IO_ERROR, &tty->flags);
 
-	if( (mcr & MCR_DTR) == MCR_DTR )
-	{
-		msr |= MSR_DSR;
-		msr |= MSR_CD;
+	down(&tty0tty->sem);
+	if (atomic_read(&tty0tty->open_count)) {
+		/* one more file on an open port, nothing to reset */
+		tty->driver_data = tty0tty;
+		atomic_inc(&tty0tty->open_count);
+		trace_tty0tty_open(tty0tty->index, atomic_read(&tty0tty->open_count));
+		up(&tty0tty->sem);
+		return 0;
 	}
 
-	tty0tty->msr = msr;
-	tty0tty->mcr = 0;
+	/* like a UART, DTR and RTS go up on open unless the line is at B0 */
+	spin_lock_irq(&tty0tty->msr_lock);
+	WRITE_ONCE(tty0tty->msr, 0);
+	WRITE_ONCE(tty0tty->mcr, C_BAUD(tty) ? MCR_DTR | MCR_RTS : 0);
 	memset(&tty0tty->icount, 0, sizeof(tty0tty->icount));
+	spin_unlock_irq(&tty0tty->msr_lock);
+	atomic64_set(&tty0tty->tx_bytes, 0);
+	atomic64_set(&tty0tty->rx_bytes, 0);
+	atomic64_set(&tty0tty->dropped, 0);
+	atomic64_set(&tty0tty->pushes, 0);
+	tty0tty->stats_time = 0;
+	tty0tty_cache_termios(tty0tty, tty);
+	clear_bit(TTY0TTY_THROTTLED, &tty0tty->flags);
 
-	init_waitqueue_head(&tty0tty->wait);
+	/* save our structure within the tty structure */
+	tty->driver_data = tty0tty;
 
-	/* register the tty driver_data */
+	atomic_inc(&tty0tty->open_count);
+	trace_tty0tty_open(tty0tty->index, atomic_read(&tty0tty->open_count));
 
-	down(&tty0tty->sem);
+	/*
+	 * The peer sees us from now on. Its tiocmset() writes mcr before
+	 * looking us up, we read it after publishing, under msr_lock like
+	 * its tty0tty_set_msr(): whoever comes last sets the right lines.
+	 */
+	rcu_assign_pointer(tty0tty_table[index ^ 1].peer, tty0tty);
+	smp_mb();
 
-	/* save our structure within the tty structure */
-	tty->driver_data = tty0tty;
-	tty0tty->tty = tty;
+	spin_lock_irq(&tty0tty->msr_lock);
+	if ((shadow = get_shadow_tty(index)) != NULL)
+		mcr = READ_ONCE(shadow->mcr);
 
-	++tty0tty->open_count;
+//null modem connection
+	msr = tty0tty_mcr_to_msr(mcr);
+	/* /dev/tntdN was opened first, the wire keeps CTS, DSR and CD up */
+	if (test_bit(TTY0TTY_WIRE, &tty0tty->flags))
+		msr = MSR_CTS | MSR_DSR | MSR_CD;
+	WRITE_ONCE(tty0tty->msr, msr);
+	spin_unlock_irq(&tty0tty->msr_lock);
 
 	up(&tty0tty->sem);
 
+	/* the peer sees our DTR and RTS, a writer waiting for CTS goes on */
+	if ((shadow = get_shadow_tty(index)) != NULL)
+		tty0tty_follow_mcr(shadow, tty0tty);
+
     /* Notify open*/
-	if (tty0tty_dev[index]){
-		sysfs_notify(&tty0tty_dev[index]->kobj, NULL, "baudrate");
+	if (tty0tty->dev){
+		sysfs_notify(&tty0tty->dev->kobj, NULL, "baudrate");
+		sysfs_notify(&tty0tty->dev->kobj, NULL, "modem");
 #ifdef SCULL_DEBUG
 	    printk(KERN_DEBUG "%s - %s\n", __FUNCTION__, "sysfs_notify baudrate (open)");
 #endif
@@ -284,21 +2072,56 @@ static int tty0tty_open(struct tty_struct *tty, struct file *file)
 static void tty0tty_do_close(struct tty0tty_serial *tty0tty)
 {
 	unsigned int msr=0;
+	struct device *dev;
 
 #ifdef SCULL_DEBUG
-	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__,tty0tty->tty->index);
+	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__,tty0tty->index);
 #endif
-	tty0tty_update_shadow_msr(tty0tty->tty->index, msr);
-
 	down(&tty0tty->sem);
-	if (tty0tty->open_count) {
-		--tty0tty->open_count;
+	if (atomic_read(&tty0tty->open_count)) {
+		trace_tty0tty_close(tty0tty->index,
+				    atomic_read(&tty0tty->open_count) - 1);
+		if (atomic_dec_and_test(&tty0tty->open_count)) {
+			/*
+			 * The other files keep our lines up until the last
+			 * close, then HUPCL drops DTR and RTS like on a UART.
+			 */
+			if (tty0tty->cflag & HUPCL) {
+				spin_lock_irq(&tty0tty->msr_lock);
+				WRITE_ONCE(tty0tty->mcr,
+					   tty0tty->mcr & ~(MCR_DTR | MCR_RTS));
+				spin_unlock_irq(&tty0tty->msr_lock);
+				tty0tty_update_shadow_msr(tty0tty->index, msr);
+			}
+
+			/* no new deliveries to us, wait for the running ones */
+			RCU_INIT_POINTER(tty0tty_table[tty0tty->index ^ 1].peer, NULL);
+			synchronize_rcu();
+
+			hrtimer_cancel(&tty0tty->pace_timer);
+			clear_bit(TTY0TTY_PACING, &tty0tty->flags);
+			hrtimer_cancel(&tty0tty->delay_timer);
+			if (tty0tty->delay) {
+				/* an idle link for the next open */
+				tty0tty->delay->link_free = 0;
+				tty0tty->delay->last_release = 0;
+			}
+
+			/* unsent data does not survive the last close */
+			set_bit(TTY0TTY_FLUSH, &tty0tty->flags);
+			tty0tty_drain(tty0tty);
+			tty_port_tty_set(&tty0tty->port, NULL);
+
+			/* a writer of /dev/tntdN drops the rest now */
+			atomic_inc(&tty0tty->wire_room);
+			wake_up_interruptible(&tty0tty->wire_wait);
+		}
 	}
 	up(&tty0tty->sem);
 
 	/* Notify close*/
-	if (tty0tty_dev[tty0tty->tty->index]){
-		sysfs_notify(&tty0tty_dev[tty0tty->tty->index]->kobj, NULL, "baudrate");
+	if ((dev = tty0tty->dev)){
+		sysfs_notify(&dev->kobj, NULL, "baudrate");
 #ifdef SCULL_DEBUG
 	    printk(KERN_DEBUG "%s - %s\n", __FUNCTION__, "sysfs_notify baudrate (close)");
 #endif
@@ -318,6 +2141,22 @@ static void tty0tty_close(struct tty_struct *tty, struct file *file)
 		tty0tty_do_close(tty0tty);
 }
 
+/*
+ * tty_hangup() and vhangup(), also on a pair delete. The files are
+ * closed later through close(), a TIOCMIWAIT sleeper returns EIO now.
+ */
+static void tty0tty_hangup(struct tty_struct *tty)
+{
+	struct tty0tty_serial *tty0tty = tty->driver_data;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
+#endif
+	set_bit(TTY_IO_ERROR, &tty->flags);
+	if (tty0tty)
+		wake_up_interruptible(&tty0tty->wait);
+}
+
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
 static ssize_t tty0tty_write(struct tty_struct *tty, const unsigned char *buffer, size_t count)
 #else
@@ -325,41 +2164,47 @@ static int tty0tty_write(struct tty_struct *tty, const unsigned char *buffer, in
 #endif
 {
 	struct tty0tty_serial *tty0tty = tty->driver_data;
-	struct tty0tty_serial *shadow;
-	struct tty_struct  *ttyx = NULL;
+	unsigned int done = 0;
+	unsigned int start;
+	unsigned long flags;
+	int delay;
 
 #ifdef SCULL_DEBUG
-	int i;
-	printk(KERN_DEBUG "%s -tnt%i  [%02i] \n", __FUNCTION__,tty->index, count);
-	for(i=0;i<count;i++)
-		printk(KERN_DEBUG " 0x%02X \n",buffer[i]);
+	printk(KERN_DEBUG "%s -tnt%i  [%02i] \n", __FUNCTION__,tty->index, (int)count);
+	print_hex_dump(KERN_DEBUG, "", DUMP_PREFIX_OFFSET, 16, 1, buffer, count, false);
 #endif
 
 	if (!tty0tty)
 		return -ENODEV;
 
-	down(&tty0tty->sem);
-	if (tty0tty->open_count)
+	if (atomic_read(&tty0tty->open_count))
 	{
-	  if ((shadow = get_shadow_tty(tty0tty->tty->index)) != NULL)
-	  	  ttyx = shadow->tty;
-//        tty->low_latency=1;
-	  if(ttyx != NULL)
-	  {
-		  if((tty->termios.c_cflag & PARENB) && (tty->termios.c_cflag & CMSPAR) && (tty->termios.c_cflag & PARODD))
-		  {
-			  /* MARK parity bit. */
-			  tty_insert_flip_string_fixed_flag(ttyx->port, buffer, TTY_PARITY, count);
-		  }
-		  else
-		  {
-		  	  tty_insert_flip_string(ttyx->port, buffer, count);
-		  }
-		  tty_flip_buffer_push(ttyx->port);
-	  }
+		/* echoes and TCXONC may write next to write(), irqs for ppp */
+		spin_lock_irqsave(&tty0tty->write_lock, flags);
+		if (unlikely(tty0tty_lat_enable) && !tty0tty->lat_start)
+			tty0tty->lat_start = ktime_get_ns();
+
+		/* link emulation, every write in flight needs a mark */
+		delay = READ_ONCE(tty0tty->delay_on);
+		if (unlikely(delay) && tty0tty_delay_full(tty0tty))
+			count = 0;
+
+		/* a short count makes the line discipline wait for tty_wakeup() */
+		start = tty0tty->xmit.head;
+		done = tty0tty_ring_put(&tty0tty->xmit, buffer, count);
+		if (unlikely(delay) && done)
+			tty0tty_delay_mark(tty0tty, start, done);
+		/* the records keep the order of the data in xmit */
+		if (unlikely(tty0tty_capturing(tty0tty)) && done)
+			tty0tty_capture(tty0tty, TTY0TTY_CAP_DATA, buffer, done);
+		spin_unlock_irqrestore(&tty0tty->write_lock, flags);
+
+		trace_tty0tty_write(tty->index, count, done);
+		if (test_bit(TTY0TTY_WIRE, &tty0tty->flags))
+			wake_up_interruptible(&tty0tty->wire_wait);
+		tty0tty_drain(tty0tty);
 	}
-	up(&tty0tty->sem);
-	return count;
+	return done;
 }
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
@@ -378,16 +2223,46 @@ static int tty0tty_write_room(struct tty_struct *tty)
 	if (!tty0tty)
 		return -ENODEV;
 
-	down(&tty0tty->sem);
-	if (tty0tty->open_count) 
+	if (atomic_read(&tty0tty->open_count))
 	{
 		/* calculate how much room is left in the device */
-	    room = 255;
+		room = tty0tty_ring_room(&tty0tty->xmit);
+		if (unlikely(READ_ONCE(tty0tty->delay_on)) && tty0tty_delay_full(tty0tty))
+			room = 0;
 	}
-	up(&tty0tty->sem);
 	return room;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+static unsigned int tty0tty_chars_in_buffer(struct tty_struct *tty)
+#else
+static int tty0tty_chars_in_buffer(struct tty_struct *tty)
+#endif
+{
+	struct tty0tty_serial *tty0tty = tty->driver_data;
+
+	if (!tty0tty)
+		return 0;
+
+	return tty0tty_ring_used(&tty0tty->xmit);
+}
+
+static void tty0tty_flush_buffer(struct tty_struct *tty)
+{
+	struct tty0tty_serial *tty0tty = tty->driver_data;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
+#endif
+
+	if (!tty0tty)
+		return;
+
+	set_bit(TTY0TTY_FLUSH, &tty0tty->flags);
+	tty0tty_drain(tty0tty);
+	tty_wakeup(tty);
+}
+
 
 
 #define RELEVANT_IFLAG(iflag) ((iflag) & (IGNBRK|BRKINT|IGNPAR|PARMRK|INPCK))
@@ -404,6 +2279,13 @@ static void tty0tty_set_termios(struct tty_struct *tty, struct ktermios *old_ter
 #endif
 
 	cflag = tty->termios.c_cflag;
+	trace_tty0tty_termios(tty->index, cflag, tty->termios.c_ospeed);
+
+	if (tty->driver_data) {
+		tty0tty_cache_termios(tty->driver_data, tty);
+		/* CRTSCTS may have been switched off */
+		tty0tty_kick(tty->driver_data);
+	}
 
 	/* check that they really want us to change something */
 	if (old_termios) {
@@ -483,8 +2365,8 @@ static void tty0tty_set_termios(struct tty_struct *tty, struct ktermios *old_ter
 #endif
 
     /* Notify speed*/
-	if (tty0tty_dev[tty->index]){
-		sysfs_notify(&tty0tty_dev[tty->index]->kobj, NULL, "baudrate");
+	if (tty0tty_table[tty->index].dev){
+		sysfs_notify(&tty0tty_table[tty->index].dev->kobj, NULL, "baudrate");
 #ifdef SCULL_DEBUG
 	    printk(KERN_DEBUG "%s - %s\n", __FUNCTION__, "sysfs_notify baudrate (change)");
 #endif
@@ -526,53 +2408,116 @@ static int tty0tty_tiocmset(struct tty_struct *tty,
 {
 	struct tty0tty_serial *tty0tty = tty->driver_data;
 	struct tty0tty_serial *shadow;
-	unsigned int mcr = tty0tty->mcr;
-	unsigned int msr=0;
+	unsigned int mcr;
+	unsigned int old;
+	unsigned int loop_changed;
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - tnt%i set=0x%08X clear=0x%08X \n", __FUNCTION__,tty->index, set ,clear);
 #endif
-	if ((shadow = get_shadow_tty(tty0tty->tty->index)) != NULL)
-		msr = shadow->msr;
 
-//null modem connection
+	/* throttle() and unthrottle() change RTS next to the ioctls */
+	spin_lock_irq(&tty0tty->msr_lock);
+	old = mcr = tty0tty->mcr;
 
 	if (set & TIOCM_RTS)
-	{
 		mcr |= MCR_RTS;
-		msr |= MSR_CTS;
-	}
 
 	if (set & TIOCM_DTR)
-	{
 		mcr |= MCR_DTR;
-		msr |= MSR_DSR;
-		msr |= MSR_CD;
-	}
 
 	if (clear & TIOCM_RTS)
-	{
 		mcr &= ~MCR_RTS;
-		msr &= ~MSR_CTS;
-	}
 
 	if (clear & TIOCM_DTR)
-	{
 		mcr &= ~MCR_DTR;
-		msr &= ~MSR_DSR;
-		msr &= ~MSR_CD;
+
+	if (set & TIOCM_LOOP)
+		mcr |= MCR_LOOP;
+
+	if (clear & TIOCM_LOOP)
+		mcr &= ~MCR_LOOP;
+
+	/* set the new MCR value in the device, see tty0tty_open() */
+	WRITE_ONCE(tty0tty->mcr, mcr);
+	spin_unlock_irq(&tty0tty->msr_lock);
+	smp_mb();
+
+	/* in loopback the port leaves the line, the peer sees our lines drop */
+	loop_changed = (mcr ^ old) & MCR_LOOP;
+	if (loop_changed && (mcr & MCR_LOOP)) {
+		shadow = &tty0tty_table[tty0tty->index ^ 1];
+		if (atomic_read(&shadow->open_count))
+			tty0tty_set_msr(shadow, 0);
 	}
 
+	if (mcr != old) {
+		trace_tty0tty_modem(tty0tty->index, mcr, tty0tty->msr);
+		tty0tty_notify_modem(tty0tty);
+		if (unlikely(tty0tty_capturing(tty0tty)))
+			tty0tty_capture(tty0tty, TTY0TTY_CAP_MODEM, NULL, 0);
+	}
 
-	/* set the new MCR value in the device */
-	tty0tty->mcr = mcr;
+//null modem connection
+	if (mcr & MCR_LOOP) {
+		/* RTS -> CTS, DTR -> DSR and CD of the port itself */
+		tty0tty_follow_mcr(tty0tty, tty0tty);
+	} else if ((shadow = get_shadow_tty(tty0tty->index)) != NULL) {
+		/* back on the line, we see the peer again */
+		if (loop_changed)
+			tty0tty_follow_mcr(tty0tty, shadow);
+		tty0tty_follow_mcr(shadow, tty0tty);
+	} else if (loop_changed) {
+		tty0tty_set_msr(tty0tty, 0);
+	}
 
-	tty0tty_update_shadow_msr(tty0tty->tty->index, msr);
+	if (loop_changed)
+		tty0tty_kick(tty0tty);
 
 	return 0;
 }
 
 
+/*
+ * Called by the line discipline when its buffer fills up. The peer
+ * stops sending, and with CRTSCTS our RTS drops like on a real UART.
+ */
+static void tty0tty_throttle(struct tty_struct *tty)
+{
+	struct tty0tty_serial *tty0tty = tty->driver_data;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
+#endif
+
+	set_bit(TTY0TTY_THROTTLED, &tty0tty->flags);
+
+	if (C_CRTSCTS(tty))
+		tty0tty_tiocmset(tty, 0, TIOCM_RTS);
+}
+
+static void tty0tty_unthrottle(struct tty_struct *tty)
+{
+	struct tty0tty_serial *tty0tty = tty->driver_data;
+	struct tty0tty_serial *shadow;
+
+#ifdef SCULL_DEBUG
+	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
+#endif
+
+	clear_bit(TTY0TTY_THROTTLED, &tty0tty->flags);
+
+	if (C_CRTSCTS(tty))
+		tty0tty_tiocmset(tty, TIOCM_RTS, 0);
+
+	/* whoever sends to us, the peer or ourselves in loopback */
+	if ((shadow = tty0tty_dest(tty0tty)) != NULL)
+		tty0tty_kick(shadow);
+	atomic_inc(&tty0tty->wire_room);
+	wake_up_interruptible(&tty0tty->wire_wait);
+}
+
+
 static int tty0tty_ioctl_tiocgserial(struct tty_struct *tty,
 			unsigned long arg)
 {
@@ -592,7 +2537,7 @@ static int tty0tty_ioctl_tiocgserial(struct tty_struct *tty,
 	tmp.line		= tty0tty->serial.line;
 	tmp.port		= tty0tty->serial.port;
 	tmp.irq			= tty0tty->serial.irq;
-	tmp.flags		= ASYNC_SKIP_TEST | ASYNC_AUTO_IRQ;
+	tmp.flags		= tty0tty->serial.flags;
 	tmp.xmit_fifo_size	= tty0tty->serial.xmit_fifo_size;
 	tmp.baud_base		= tty0tty->serial.baud_base;
 	tmp.close_delay		= 5*HZ;
@@ -606,69 +2551,118 @@ static int tty0tty_ioctl_tiocgserial(struct tty_struct *tty,
 	return 0;
 }
 
+/*
+ * setserial: xmit_fifo_size is the usable part of the transmit buffer,
+ * 1 to bufsize (0 for all of it), ASYNC_LOW_LATENCY pushes the data
+ * received at once, without it the pushes are batched, see
+ * tty0tty_push(). Only root may change xmit_fifo_size.
+ */
+static int tty0tty_do_set_serial(struct tty0tty_serial *tty0tty,
+			struct serial_struct *ss)
+{
+	int fifo = ss->xmit_fifo_size ? ss->xmit_fifo_size : bufsize;
+
+	if (fifo < 1 || fifo > bufsize)
+		return -EINVAL;
+
+	if (fifo != tty0tty->serial.xmit_fifo_size && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	tty0tty->serial.flags = (tty0tty->serial.flags & ~ASYNC_USR_MASK) |
+				(ss->flags & ASYNC_USR_MASK);
+	tty0tty->serial.custom_divisor = ss->custom_divisor;
+	tty0tty->serial.xmit_fifo_size = fifo;
+
+	WRITE_ONCE(tty0tty->xmit.limit, fifo);
+	WRITE_ONCE(tty0tty->low_latency,
+		   (tty0tty->serial.flags & ASYNC_LOW_LATENCY) ? 1 : 0);
+
+	/* the writer may have more room now */
+	tty_port_tty_wakeup(&tty0tty->port);
+	return 0;
+}
+
 static int tty0tty_ioctl_tiocsserial(struct tty_struct *tty,
 			unsigned long arg)
 {
+	struct serial_struct tmp;
+
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - tnt%i \n", __FUNCTION__, tty->index);
 #endif
-	
-	return -ENOIOCTLCMD; //TODO
+
+	if (copy_from_user(&tmp, (void __user *)arg, sizeof(tmp)))
+		return -EFAULT;
+
+	return tty0tty_do_set_serial(tty->driver_data, &tmp);
+}
+
+/* did one of the lines in mask change since cprev was taken */
+static int tty0tty_msr_changed(struct tty0tty_serial *tty0tty,
+			unsigned long mask, const struct async_icount *cprev)
+{
+	struct async_icount cnow;
+
+	spin_lock_irq(&tty0tty->msr_lock);
+	cnow = tty0tty->icount;
+	spin_unlock_irq(&tty0tty->msr_lock);
+
+	return ((mask & TIOCM_RNG) && (cnow.rng != cprev->rng)) ||
+	       ((mask & TIOCM_DSR) && (cnow.dsr != cprev->dsr)) ||
+	       ((mask & TIOCM_CD)  && (cnow.dcd != cprev->dcd)) ||
+	       ((mask & TIOCM_CTS) && (cnow.cts != cprev->cts));
 }
 
+/*
+ * Sleep until one of the lines in arg changes. The counters are
+ * sampled before sleeping, so a change between the ioctl and the
+ * sleep is not lost. A hangup of the port ends the wait with -EIO.
+ */
 static int tty0tty_ioctl_tiocmiwait(struct tty_struct *tty,
 			unsigned long arg)
 {
 	struct tty0tty_serial *tty0tty = tty->driver_data;
-	DECLARE_WAITQUEUE(wait, current);
-	struct async_icount cnow;
 	struct async_icount cprev;
+	int retval;
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
 #endif
+	spin_lock_irq(&tty0tty->msr_lock);
 	cprev = tty0tty->icount;
-	while (1) {
-		add_wait_queue(&tty0tty->wait, &wait);
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule();
-		remove_wait_queue(&tty0tty->wait, &wait);
-
-		/* see if a signal woke us up */
-		if (signal_pending(current))
-			return -ERESTARTSYS;
+	spin_unlock_irq(&tty0tty->msr_lock);
 
-		cnow = tty0tty->icount;
-		if (cnow.rng == cprev.rng && cnow.dsr == cprev.dsr &&
-		    cnow.dcd == cprev.dcd && cnow.cts == cprev.cts)
-			return -EIO; /* no change => error */
-		if (((arg & TIOCM_RNG) && (cnow.rng != cprev.rng)) ||
-		    ((arg & TIOCM_DSR) && (cnow.dsr != cprev.dsr)) ||
-		    ((arg & TIOCM_CD)  && (cnow.dcd != cprev.dcd)) ||
-		    ((arg & TIOCM_CTS) && (cnow.cts != cprev.cts)) ) {
-			return 0;
-		}
-		cprev = cnow;
-	}
+	retval = wait_event_interruptible(tty0tty->wait,
+			tty0tty_msr_changed(tty0tty, arg, &cprev) ||
+			test_bit(TTY_IO_ERROR, &tty->flags));
+	if (retval)
+		return retval;
+
+	if (test_bit(TTY_IO_ERROR, &tty->flags))
+		return -EIO;
+	return 0;
 }
 
 static int tty0tty_ioctl_tiocgicount(struct tty_struct *tty,
 			unsigned long arg)
 {
 	struct tty0tty_serial *tty0tty = tty->driver_data;
-	struct async_icount cnow = tty0tty->icount;
+	struct async_icount cnow;
 	struct serial_icounter_struct icount;
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - tnt%i\n", __FUNCTION__, tty->index);
 #endif
+	spin_lock_irq(&tty0tty->msr_lock);
+	cnow = tty0tty->icount;
+	spin_unlock_irq(&tty0tty->msr_lock);
 
 	icount.cts	= cnow.cts;
 	icount.dsr	= cnow.dsr;
 	icount.rng	= cnow.rng;
 	icount.dcd	= cnow.dcd;
-	icount.rx	= cnow.rx;
-	icount.tx	= cnow.tx;
+	icount.rx	= atomic64_read(&tty0tty->rx_bytes);
+	icount.tx	= atomic64_read(&tty0tty->tx_bytes);
 	icount.frame	= cnow.frame;
 	icount.overrun	= cnow.overrun;
 	icount.parity	= cnow.parity;
@@ -818,11 +2812,19 @@ static int tty0tty_ioctl(struct tty_struct *tty,
 
 
 static int tty0tty_break_ctl(struct tty_struct *tty, int state){
+	struct tty0tty_serial *tty0tty = tty->driver_data;
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - %i \n", __FUNCTION__, state);
 #endif
 
+	/* the start of a break reaches the peer as a TTY_BREAK character */
+	if (state && tty0tty) {
+		if (unlikely(tty0tty_capturing(tty0tty)))
+			tty0tty_capture(tty0tty, TTY0TTY_CAP_BREAK, NULL, 0);
+		set_bit(TTY0TTY_BREAK, &tty0tty->flags);
+		tty0tty_drain(tty0tty);
+	}
 	return 0;
 }
 
@@ -842,7 +2844,7 @@ static int tty0tty_get_serial(struct tty_struct *tty, struct serial_struct *ss){
 	ss->line		= tty0tty->serial.line;
 	ss->port		= tty0tty->serial.port;
 	ss->irq			= tty0tty->serial.irq;
-	ss->flags		= ASYNC_SKIP_TEST | ASYNC_AUTO_IRQ;
+	ss->flags		= tty0tty->serial.flags;
 	ss->xmit_fifo_size	= tty0tty->serial.xmit_fifo_size;
 	ss->baud_base		= tty0tty->serial.baud_base;
 	ss->close_delay		= 5*HZ;
@@ -858,18 +2860,26 @@ static int tty0tty_set_serial(struct tty_struct *tty, struct serial_struct *ss){
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - tnt%i \n", __FUNCTION__, tty->index);
 #endif
-  return -ENOIOCTLCMD; //TODO
+	if (ss == NULL)
+		return -EFAULT;
+
+	return tty0tty_do_set_serial(tty->driver_data, ss);
 }
 
 
 static struct tty_operations serial_ops = {
 	.open = tty0tty_open,
 	.close = tty0tty_close,
+	.hangup = tty0tty_hangup,
 	.write = tty0tty_write,
 	.write_room = tty0tty_write_room,
+	.chars_in_buffer = tty0tty_chars_in_buffer,
+	.flush_buffer = tty0tty_flush_buffer,
 	.set_termios = tty0tty_set_termios,
 	.tiocmget = tty0tty_tiocmget,
 	.tiocmset = tty0tty_tiocmset,
+	.throttle = tty0tty_throttle,
+	.unthrottle = tty0tty_unthrottle,
 	.ioctl = tty0tty_ioctl,
 	.break_ctl = tty0tty_break_ctl,
 	.get_serial = tty0tty_get_serial,
@@ -879,19 +2889,708 @@ static struct tty_operations serial_ops = {
 
 static struct tty_driver *tty0tty_tty_driver;
 
+
+/*
+ * /dev/tntdN, the wire side of tntN. While it is open it replaces the
+ * other end of the line: what tntN writes is read from it, what is
+ * written to it is received by tntN, the peer is disconnected. It
+ * supports splice() and sendfile(), to replay a capture into a port or
+ * record one without a copy through user space.
+ */
+static dev_t tty0tty_wire_devt;
+static struct class *tty0tty_wire_class;
+static struct cdev tty0tty_wire_cdev;
+
+static int tty0tty_wire_open(struct inode *inode, struct file *file)
+{
+	struct tty0tty_serial *tty0tty;
+	struct tty0tty_serial *shadow;
+	unsigned int index = iminor(inode);
+
+	if (index >= tty0tty_minors || !tty0tty_table[index].dev)
+		return -ENODEV;
+	tty0tty = &tty0tty_table[index];
+
+	if (test_and_set_bit(TTY0TTY_WIRE, &tty0tty->flags))
+		return -EBUSY;
+
+	tty0tty->wire_buf = (unsigned char *)__get_free_page(GFP_KERNEL);
+	if (!tty0tty->wire_buf) {
+		clear_bit(TTY0TTY_WIRE, &tty0tty->flags);
+		return -ENOMEM;
+	}
+
+	/* the peer loses the line, the wire keeps CTS, DSR and CD up */
+	shadow = &tty0tty_table[index ^ 1];
+	if (atomic_read(&shadow->open_count))
+		tty0tty_set_msr(shadow, 0);
+	if (atomic_read(&tty0tty->open_count))
+		tty0tty_set_msr(tty0tty, MSR_CTS | MSR_DSR | MSR_CD);
+
+	file->private_data = tty0tty;
+	return nonseekable_open(inode, file);
+}
+
+static int tty0tty_wire_release(struct inode *inode, struct file *file)
+{
+	struct tty0tty_serial *tty0tty = file->private_data;
+	struct tty0tty_serial *shadow = &tty0tty_table[tty0tty->index ^ 1];
+
+	free_page((unsigned long)tty0tty->wire_buf);
+	tty0tty->wire_buf = NULL;
+	clear_bit(TTY0TTY_WIRE, &tty0tty->flags);
+
+	/* back on the null modem, mcr of a closed port is stale */
+	if (atomic_read(&tty0tty->open_count)) {
+		tty0tty_set_msr(tty0tty, get_shadow_tty(tty0tty->index) ?
+				tty0tty_mcr_to_msr(shadow->mcr) : 0);
+		tty0tty_update_shadow_msr(tty0tty->index,
+				tty0tty_mcr_to_msr(tty0tty->mcr));
+	}
+	tty0tty_kick(tty0tty);
+	tty0tty_kick(shadow);
+	return 0;
+}
+
+/* what tntN wrote, straight from its xmit ring */
+static ssize_t tty0tty_wire_read(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct tty0tty_serial *tty0tty = iocb->ki_filp->private_data;
+	unsigned char *data;
+	unsigned int count = 0;
+	size_t done = 0;
+	size_t n;
+	int retval;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	for (;;) {
+		if (tty0tty_ring_empty(&tty0tty->xmit)) {
+			if ((iocb->ki_filp->f_flags & O_NONBLOCK) ||
+			    (iocb->ki_flags & IOCB_NOWAIT))
+				return -EAGAIN;
+			retval = wait_event_interruptible(tty0tty->wire_wait,
+					!tty0tty_ring_empty(&tty0tty->xmit));
+			if (retval)
+				return retval;
+		}
+
+		/* we are the consumer of xmit now, tty0tty_drain() backs off */
+		retval = wait_event_interruptible(tty0tty->wire_wait,
+			!test_and_set_bit_lock(TTY0TTY_DRAINING, &tty0tty->flags));
+		if (retval)
+			return retval;
+
+		while (iov_iter_count(to) &&
+		       (count = tty0tty_ring_peek(&tty0tty->xmit, &data)) > 0) {
+			n = copy_to_iter(data, min_t(size_t, count, iov_iter_count(to)), to);
+			if (!n)
+				break;
+			tty0tty_ring_consume(&tty0tty->xmit, n);
+			done += n;
+		}
+		clear_bit_unlock(TTY0TTY_DRAINING, &tty0tty->flags);
+
+		if (done)
+			break;
+		/* data left that could not be copied */
+		if (count)
+			return -EFAULT;
+		/* a flush of tntN emptied xmit after the wait, wait again */
+	}
+
+	atomic64_add(done, &tty0tty->tx_bytes);
+	tty_port_tty_wakeup(&tty0tty->port);
+	return done;
+}
+
+/* received by tntN, through its flip buffer */
+static ssize_t tty0tty_wire_write(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct tty0tty_serial *tty0tty = iocb->ki_filp->private_data;
+	int nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+		       (iocb->ki_flags & IOCB_NOWAIT);
+	unsigned long flags;
+	size_t done = 0;
+	size_t len;
+	unsigned int n;
+	int room;
+
+	while (iov_iter_count(from)) {
+		/* nobody listening, a null modem loses the data */
+		if (!atomic_read(&tty0tty->open_count)) {
+			len = iov_iter_count(from);
+			iov_iter_advance(from, len);
+			done += len;
+			break;
+		}
+
+		len = copy_from_iter(tty0tty->wire_buf,
+			min_t(size_t, iov_iter_count(from), PAGE_SIZE), from);
+		if (!len)
+			return done ? done : -EFAULT;
+
+		/* a wakeup after this is not lost, see below */
+		room = atomic_read(&tty0tty->wire_room);
+		n = 0;
+		spin_lock_irqsave(&tty0tty->rx_lock, flags);
+		if (!test_bit(TTY0TTY_THROTTLED, &tty0tty->flags))
+			n = tty_insert_flip_string(&tty0tty->port,
+					tty0tty->wire_buf, len);
+		if (n)
+			tty0tty_push(tty0tty, NULL, n);
+		spin_unlock_irqrestore(&tty0tty->rx_lock, flags);
+
+		atomic64_add(n, &tty0tty->rx_bytes);
+		done += n;
+		if (n == len) {
+			WRITE_ONCE(tty0tty->retry_delay, 1);
+			continue;
+		}
+
+		/* tntN is not reading, wait for it like a writer on a full tty */
+		iov_iter_revert(from, len - n);
+		if (done)
+			break;
+		if (nonblock)
+			return -EAGAIN;
+
+		/*
+		 * Throttled, unthrottle() wakes us. Else the flip buffer is
+		 * full while the line discipline takes it, no callback tells
+		 * when: the retry work wakes us with the backoff of a full
+		 * peer, see tty0tty_retry_later().
+		 */
+		if (!test_bit(TTY0TTY_THROTTLED, &tty0tty->flags))
+			tty0tty_retry_later(tty0tty);
+		if (wait_event_interruptible(tty0tty->wire_wait,
+				atomic_read(&tty0tty->wire_room) != room))
+			return -ERESTARTSYS;
+	}
+	return done;
+}
+
+static __poll_t tty0tty_wire_poll(struct file *file, poll_table *wait)
+{
+	struct tty0tty_serial *tty0tty = file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &tty0tty->wire_wait, wait);
+
+	if (!tty0tty_ring_empty(&tty0tty->xmit))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (!test_bit(TTY0TTY_THROTTLED, &tty0tty->flags))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+static const struct file_operations tty0tty_wire_fops = {
+	.owner = THIS_MODULE,
+	.open = tty0tty_wire_open,
+	.release = tty0tty_wire_release,
+	.read_iter = tty0tty_wire_read,
+	.write_iter = tty0tty_wire_write,
+	.poll = tty0tty_wire_poll,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
+};
+
+static int tty0tty_wire_init(void)
+{
+	int retval;
+
+	retval = alloc_chrdev_region(&tty0tty_wire_devt, 0, tty0tty_minors, "tntd");
+	if (retval)
+		return retval;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	tty0tty_wire_class = class_create("tty0tty");
+#else
+	tty0tty_wire_class = class_create(THIS_MODULE, "tty0tty");
+#endif
+	if (IS_ERR(tty0tty_wire_class)) {
+		retval = PTR_ERR(tty0tty_wire_class);
+		goto err_region;
+	}
+
+	cdev_init(&tty0tty_wire_cdev, &tty0tty_wire_fops);
+	tty0tty_wire_cdev.owner = THIS_MODULE;
+	retval = cdev_add(&tty0tty_wire_cdev, tty0tty_wire_devt, tty0tty_minors);
+	if (retval)
+		goto err_class;
+	return 0;
+
+err_class:
+	class_destroy(tty0tty_wire_class);
+err_region:
+	unregister_chrdev_region(tty0tty_wire_devt, tty0tty_minors);
+	return retval;
+}
+
+static void tty0tty_wire_exit(void)
+{
+	cdev_del(&tty0tty_wire_cdev);
+	class_destroy(tty0tty_wire_class);
+	unregister_chrdev_region(tty0tty_wire_devt, tty0tty_minors);
+}
+
+
+/* pair control, /sys/class/misc/tnt_ctl/ */
+
+static DEFINE_MUTEX(tty0tty_ctl_mutex);	/* serializes pair and topology changes */
+static LIST_HEAD(tty0tty_groups);		/* buses and stars, under tty0tty_ctl_mutex */
+
+/* back to pair mode for all the members, called with tty0tty_ctl_mutex held */
+static void tty0tty_group_free(struct tty0tty_group *group)
+{
+	unsigned int i;
+
+	for (i = 0; i < group->count; i++)
+		RCU_INIT_POINTER(tty0tty_table[group->member[i]].group, NULL);
+	list_del(&group->list);
+
+	/* data of the pairs may be waiting for the peer */
+	for (i = 0; i < group->count; i++) {
+		tty0tty_kick(&tty0tty_table[group->member[i]]);
+		tty0tty_kick(&tty0tty_table[group->member[i] ^ 1]);
+	}
+	kfree_rcu(group, rcu);
+}
+
+/*
+ * Settings of a new port, at load and when a pair is deleted: a pair
+ * created again in the same slot inherits nothing from the previous
+ * one. Every per-port knob has its default here.
+ */
+static void tty0tty_port_defaults(struct tty0tty_serial *tty0tty)
+{
+	/* setserial */
+	WRITE_ONCE(tty0tty->xmit.limit, bufsize);
+	WRITE_ONCE(tty0tty->low_latency, 1);
+	tty0tty->serial.flags = ASYNC_SKIP_TEST | ASYNC_AUTO_IRQ |
+				ASYNC_LOW_LATENCY;
+	tty0tty->serial.xmit_fifo_size = bufsize;
+	tty0tty->serial.custom_divisor = 0;
+
+	/* sysfs: pacing, push coalescing, fault injection, link emulation */
+	WRITE_ONCE(tty0tty->pacing, 0);
+	WRITE_ONCE(tty0tty->coalesce_ns, 0);
+	WRITE_ONCE(tty0tty->coalesce_bytes, 0);
+	WRITE_ONCE(tty0tty->fault_rate, 0);
+	WRITE_ONCE(tty0tty->fault_mode, TTY0TTY_FAULT_CORRUPT);
+	WRITE_ONCE(tty0tty->delay_on, 0);
+	WRITE_ONCE(tty0tty->delay_us, 0);
+	WRITE_ONCE(tty0tty->jitter_us, 0);
+	WRITE_ONCE(tty0tty->rate_limit, 0);
+
+	/* strict mode, drops the table */
+	WRITE_ONCE(tty0tty->strict, 0);
+	tty0tty_build_xlat(tty0tty);
+
+	tty0tty->retry_delay = 1;
+}
+
+/*
+ * Called by tty0tty_delete_pair() once the users of the port saw the
+ * hangup: the settings go back to their defaults, with delay_on and
+ * pacing off nothing arms the timers again, then the pending ones are
+ * stopped.
+ */
+static void tty0tty_reset_port(struct tty0tty_serial *tty0tty)
+{
+	unsigned long flags;
+
+	tty0tty_port_defaults(tty0tty);
+
+	hrtimer_cancel(&tty0tty->pace_timer);
+	clear_bit(TTY0TTY_PACING, &tty0tty->flags);
+	hrtimer_cancel(&tty0tty->delay_timer);
+	hrtimer_cancel(&tty0tty->push_timer);
+	spin_lock_irqsave(&tty0tty->rx_lock, flags);
+	clear_bit(TTY0TTY_PUSH, &tty0tty->flags);
+	tty0tty->push_bytes = 0;
+	tty0tty->push_start = 0;
+	spin_unlock_irqrestore(&tty0tty->rx_lock, flags);
+	cancel_delayed_work_sync(&tty0tty->retry);
+
+	/* the marks of the writes of the previous pair, an idle link */
+	if (tty0tty->delay)
+		memset(tty0tty->delay, 0, sizeof(*tty0tty->delay));
+	clear_bit(TTY0TTY_BREAK, &tty0tty->flags);
+	tty0tty->pace_next = 0;
+	tty0tty->lat_start = 0;
+}
+
+static int tty0tty_create_pair(unsigned int pair)
+{
+	struct tty0tty_serial *tty0tty;
+	int retval;
+	int i;
+
+	if (pair >= max_pairs)
+		return -EINVAL;
+
+	if (tty0tty_table[pair * 2].dev)
+		return -EEXIST;
+
+	/* a file of the previous pair in this slot would talk to the new one */
+	for (i = pair * 2; i < pair * 2 + 2; i++) {
+		if (atomic_read(&tty0tty_table[i].open_count) ||
+		    test_bit(TTY0TTY_WIRE, &tty0tty_table[i].flags))
+			return -EBUSY;
+	}
+
+	for (i = pair * 2; i < pair * 2 + 2; i++) {
+		tty0tty = &tty0tty_table[i];
+
+		/* the ring is kept after a removal, a hung up tty may still use it */
+		if (!tty0tty->xmit.buf) {
+			tty0tty->xmit.buf = kmalloc(bufsize, GFP_KERNEL);
+			if (!tty0tty->xmit.buf) {
+				retval = -ENOMEM;
+				goto err;
+			}
+		}
+
+		tty0tty->dev = tty_register_device_attr(tty0tty_tty_driver, i, NULL, tty0tty, tty0tty_dev_groups);
+		if (IS_ERR(tty0tty->dev)) {
+			retval = PTR_ERR(tty0tty->dev);
+			tty0tty->dev = NULL;
+			goto err;
+		}
+
+		/* the port works without its wire side */
+		tty0tty->wire_dev = device_create(tty0tty_wire_class, NULL,
+				MKDEV(MAJOR(tty0tty_wire_devt), i), tty0tty, "tntd%d", i);
+		if (IS_ERR(tty0tty->wire_dev)) {
+			printk(KERN_WARNING "tty0tty: no /dev/tntd%d\n", i);
+			tty0tty->wire_dev = NULL;
+		}
+	}
+	return 0;
+
+err:
+	while (--i >= (int)(pair * 2)) {
+		if (tty0tty_table[i].wire_dev)
+			device_destroy(tty0tty_wire_class,
+				       MKDEV(MAJOR(tty0tty_wire_devt), i));
+		tty0tty_table[i].wire_dev = NULL;
+		tty_unregister_device(tty0tty_tty_driver, i);
+		tty0tty_table[i].dev = NULL;
+	}
+	return retval;
+}
+
+static int tty0tty_delete_pair(unsigned int pair)
+{
+	struct tty0tty_serial *tty0tty;
+	struct tty0tty_capture *cap;
+	struct tty_struct *tty;
+	int i;
+
+	if (pair >= max_pairs)
+		return -EINVAL;
+
+	if (!tty0tty_table[pair * 2].dev)
+		return -ENODEV;
+
+	for (i = pair * 2; i < pair * 2 + 2; i++) {
+		tty0tty = &tty0tty_table[i];
+
+		if (rcu_access_pointer(tty0tty->group))
+			tty0tty_group_free(rcu_dereference_protected(tty0tty->group,
+				lockdep_is_held(&tty0tty_ctl_mutex)));
+
+		/* users of the port see a hangup, like an unplugged usb serial */
+		tty = tty_port_tty_get(&tty0tty->port);
+		if (tty) {
+			tty_vhangup(tty);
+			tty_kref_put(tty);
+		}
+
+		if (tty0tty->wire_dev)
+			device_destroy(tty0tty_wire_class,
+				       MKDEV(MAJOR(tty0tty_wire_devt), i));
+		tty0tty->wire_dev = NULL;
+		tty_unregister_device(tty0tty_tty_driver, i);
+		tty0tty->dev = NULL;
+	}
+
+	/* no attributes and no group left to change them, after the kicks above */
+	for (i = pair * 2; i < pair * 2 + 2; i++)
+		tty0tty_reset_port(&tty0tty_table[i]);
+
+	/* the capture attributes are gone with the devices */
+	mutex_lock(&tty0tty_capture_mutex);
+	cap = rcu_dereference_protected(tty0tty_table[pair * 2].capture,
+			lockdep_is_held(&tty0tty_capture_mutex));
+	RCU_INIT_POINTER(tty0tty_table[pair * 2].capture, NULL);
+	mutex_unlock(&tty0tty_capture_mutex);
+	tty0tty_capture_free(cap);
+	return 0;
+}
+
+static ssize_t new_pair_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int pair;
+	int retval;
+
+	if (kstrtouint(buf, 0, &pair))
+		return -EINVAL;
+
+	mutex_lock(&tty0tty_ctl_mutex);
+	retval = tty0tty_create_pair(pair);
+	mutex_unlock(&tty0tty_ctl_mutex);
+
+	return retval ? retval : count;
+}
+
+static ssize_t delete_pair_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int pair;
+	int retval;
+
+	if (kstrtouint(buf, 0, &pair))
+		return -EINVAL;
+
+	mutex_lock(&tty0tty_ctl_mutex);
+	retval = tty0tty_delete_pair(pair);
+	mutex_unlock(&tty0tty_ctl_mutex);
+
+	return retval ? retval : count;
+}
+
+/* list of existing pairs */
+static ssize_t pairs_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&tty0tty_ctl_mutex);
+	for (i = 0; i < max_pairs; i++)
+		if (tty0tty_table[i * 2].dev)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u ", i);
+	mutex_unlock(&tty0tty_ctl_mutex);
+
+	if (len)
+		buf[len - 1] = '\n';
+	return len;
+}
+
+/*
+ * topology: "bus 0 2 4 6" puts tnt0, tnt2, tnt4 and tnt6 on a bus,
+ * "star 0 2 4" makes tnt0 the hub of tnt2 and tnt4, "pair 2" returns
+ * the bus or star of tnt2 to pair mode. Reading lists buses and stars.
+ */
+static int tty0tty_group_create(int mode, char *list)
+{
+	struct tty0tty_group *group;
+	unsigned int index;
+	char *tok;
+	int retval = -EINVAL;
+	int i;
+
+	group = kzalloc(sizeof(*group) + TTY0TTY_GROUP_MAX * sizeof(group->member[0]),
+			GFP_KERNEL);
+	if (!group)
+		return -ENOMEM;
+	group->mode = mode;
+
+	while ((tok = strsep(&list, " \t\n")) != NULL) {
+		if (!*tok)
+			continue;
+		if (kstrtouint(tok, 0, &index) || index >= tty0tty_minors ||
+		    group->count == TTY0TTY_GROUP_MAX)
+			goto err;
+		if (!tty0tty_table[index].dev) {
+			retval = -ENODEV;
+			goto err;
+		}
+		if (rcu_access_pointer(tty0tty_table[index].group)) {
+			retval = -EBUSY;
+			goto err;
+		}
+		for (i = 0; i < group->count; i++)
+			if (group->member[i] == index)
+				goto err;
+		group->member[group->count++] = index;
+	}
+	if (group->count < 2)
+		goto err;
+
+	list_add_tail(&group->list, &tty0tty_groups);
+	for (i = 0; i < group->count; i++)
+		rcu_assign_pointer(tty0tty_table[group->member[i]].group, group);
+	return 0;
+
+err:
+	kfree(group);
+	return retval;
+}
+
+static ssize_t topology_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	char *copy, *list, *mode;
+	unsigned int index;
+	int retval = -EINVAL;
+
+	copy = kstrndup(buf, count, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	list = copy;
+	mode = strsep(&list, " \t\n");
+
+	mutex_lock(&tty0tty_ctl_mutex);
+	if (!strcmp(mode, "bus"))
+		retval = tty0tty_group_create(TTY0TTY_TOPO_BUS, list);
+	else if (!strcmp(mode, "star"))
+		retval = tty0tty_group_create(TTY0TTY_TOPO_STAR, list);
+	else if (!strcmp(mode, "pair") && list &&
+		 !kstrtouint(strim(list), 0, &index) && index < tty0tty_minors) {
+		retval = -ENOENT;
+		if (rcu_access_pointer(tty0tty_table[index].group)) {
+			tty0tty_group_free(rcu_dereference_protected(
+				tty0tty_table[index].group,
+				lockdep_is_held(&tty0tty_ctl_mutex)));
+			retval = 0;
+		}
+	}
+	mutex_unlock(&tty0tty_ctl_mutex);
+
+	kfree(copy);
+	return retval ? retval : count;
+}
+
+static ssize_t topology_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct tty0tty_group *group;
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&tty0tty_ctl_mutex);
+	list_for_each_entry(group, &tty0tty_groups, list) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s",
+			group->mode == TTY0TTY_TOPO_BUS ? "bus" : "star");
+		for (i = 0; i < group->count; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, " %u",
+				group->member[i]);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	mutex_unlock(&tty0tty_ctl_mutex);
+
+	return len;
+}
+
+static DEVICE_ATTR_WO(new_pair);
+static DEVICE_ATTR_WO(delete_pair);
+static DEVICE_ATTR_RO(pairs);
+static DEVICE_ATTR_RW(topology);
+
+static struct attribute *tty0tty_ctl_attrs[] = {
+	&dev_attr_new_pair.attr,
+	&dev_attr_delete_pair.attr,
+	&dev_attr_pairs.attr,
+	&dev_attr_topology.attr,
+	NULL
+};
+
+ATTRIBUTE_GROUPS(tty0tty_ctl);
+
+static const struct file_operations tty0tty_ctl_fops = {
+	.owner = THIS_MODULE,
+};
+
+static struct miscdevice tty0tty_ctl = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "tnt_ctl",
+	.fops = &tty0tty_ctl_fops,
+	.groups = tty0tty_ctl_groups,
+};
+
+
+/* debugfs */
+
+static int tty0tty_latency_show(struct seq_file *s, void *unused)
+{
+	u64 count[TTY0TTY_LAT_BUCKETS] = { 0 };
+	int cpu, i, last = -1;
+
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < TTY0TTY_LAT_BUCKETS; i++)
+			count[i] += per_cpu(tty0tty_lat_hist, cpu).count[i];
+
+	for (i = 0; i < TTY0TTY_LAT_BUCKETS; i++)
+		if (count[i])
+			last = i;
+
+	seq_printf(s, "%14s %14s %14s\n", "ns_from", "ns_to", "count");
+	for (i = 0; i <= last; i++)
+		seq_printf(s, "%14llu %14llu %14llu\n",
+			   i ? 1ULL << (i - 1) : 0ULL, (1ULL << i) - 1, count[i]);
+	return 0;
+}
+
+static int tty0tty_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tty0tty_latency_show, NULL);
+}
+
+/* any write clears the histogram */
+static ssize_t tty0tty_latency_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&tty0tty_lat_hist, cpu), 0,
+		       sizeof(struct tty0tty_lat_hist));
+	return count;
+}
+
+static const struct file_operations tty0tty_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = tty0tty_latency_open,
+	.read = seq_read,
+	.write = tty0tty_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init tty0tty_init(void)
 {
 	int retval;
 	int i;
 	struct tty0tty_serial *tty0tty;
+	ktime_t start = ktime_get();
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - \n", __FUNCTION__);
 #endif
+	max_pairs = clamp_t(unsigned int, max(max_pairs, pairs), 1, TTY0TTY_MAX_PAIRS);
+	pairs = min(pairs, max_pairs);
+	tty0tty_minors = max_pairs * 2;
+	bufsize = roundup_pow_of_two(clamp_t(unsigned int, bufsize, TTY0TTY_RING_MIN, TTY0TTY_RING_MAX));
+
+	tty0tty_table = vzalloc(tty0tty_minors * sizeof(*tty0tty_table));
+	if (!tty0tty_table)
+		return -ENOMEM;
+
 	/* allocate the tty driver */
-	tty0tty_tty_driver = tty_alloc_driver(TTY0TTY_MINORS, 0);
-	if (IS_ERR(tty0tty_tty_driver) || !tty0tty_tty_driver)
+	tty0tty_tty_driver = tty_alloc_driver(tty0tty_minors, 0);
+	if (IS_ERR(tty0tty_tty_driver) || !tty0tty_tty_driver) {
+		vfree(tty0tty_table);
 		return -ENOMEM;
+	}
 
 	/* initialize the tty driver */
 	tty0tty_tty_driver->owner = THIS_MODULE;
@@ -913,67 +3612,135 @@ static int __init tty0tty_init(void)
 
 	tty_set_operations(tty0tty_tty_driver, &serial_ops);
 
-	for(i=0;i<TTY0TTY_MINORS;i++)
+	for (i = 0; i < tty0tty_minors; i++)
 	{
-		tty_port_init(&tport[i]);
-		tty_port_link_device(&tport[i],tty0tty_tty_driver, i);
+		tty0tty = &tty0tty_table[i];
+		tty_port_init(&tty0tty->port);
+		tty_port_link_device(&tty0tty->port, tty0tty_tty_driver, i);
+		sema_init(&tty0tty->sem, 1);
+		spin_lock_init(&tty0tty->write_lock);
+		spin_lock_init(&tty0tty->stats_lock);
+		spin_lock_init(&tty0tty->msr_lock);
+		init_waitqueue_head(&tty0tty->wait);
+		init_waitqueue_head(&tty0tty->wire_wait);
+		atomic_set(&tty0tty->wire_room, 0);
+		atomic_set(&tty0tty->open_count, 0);
+		tty0tty->index = i;
+		tty0tty->rx_flag = TTY_NORMAL;
+		INIT_DELAYED_WORK(&tty0tty->retry, tty0tty_retry_work);
+		hrtimer_setup(&tty0tty->pace_timer, tty0tty_pace_timer,
+			      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		spin_lock_init(&tty0tty->rx_lock);
+		hrtimer_setup(&tty0tty->push_timer, tty0tty_push_timer,
+			      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		hrtimer_setup(&tty0tty->delay_timer, tty0tty_delay_timer,
+			      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		tty0tty->xmit.size = bufsize;
+
+		tty0tty->serial.type = PORT_16550A;
+		tty0tty->serial.line = i;
+		tty0tty->serial.baud_base = 115200;
+		tty0tty_port_defaults(tty0tty);
 	}
 
 	retval = tty_register_driver(tty0tty_tty_driver);
 	if (retval) {
 		printk(KERN_ERR "failed to register tty0tty tty driver");
-		tty_driver_kref_put(tty0tty_tty_driver);
-		return retval;
+		goto err_free;
+	}
+
+	retval = tty0tty_wire_init();
+	if (retval)
+		goto err_driver;
+
+	for (i = 0; i < pairs; i++) {
+		retval = tty0tty_create_pair(i);
+		if (retval)
+			goto err_unregister;
 	}
 
-	for (i = 0; i < TTY0TTY_MINORS; i++) {
-        /* first time accessing this device, let's create it */
-        tty0tty = kmalloc(sizeof(*tty0tty), GFP_KERNEL);
-        if (!tty0tty)
-           return -ENOMEM;
-        tty0tty_table[i] = tty0tty;
-        sema_init(&tty0tty->sem, 1);
-        tty0tty_table[i]->open_count = 0;
+	retval = misc_register(&tty0tty_ctl);
+	if (retval)
+		goto err_unregister;
+
+	/* debugfs is optional, errors are ignored */
+	tty0tty_debugfs = debugfs_create_dir("tty0tty", NULL);
+	debugfs_create_bool("latency_enable", 0600, tty0tty_debugfs,
+			    &tty0tty_lat_enable);
+	debugfs_create_file("latency", 0600, tty0tty_debugfs, NULL,
+			    &tty0tty_latency_fops);
 
-        tty0tty_dev[i] = tty_register_device_attr(tty0tty_tty_driver, i, NULL, tty0tty, tty0tty_dev_groups);
-        if (IS_ERR(tty0tty_dev[i])) {
-            tty_unregister_device(tty0tty_tty_driver, i);
-            return PTR_ERR(tty0tty_dev[i]);
-        }
-    }
+	printk(KERN_INFO DRIVER_DESC " " DRIVER_VERSION " - %u pairs in %lld us\n",
+		pairs, (long long)ktime_us_delta(ktime_get(), start));
+	return 0;
 
-	printk(KERN_INFO DRIVER_DESC " " DRIVER_VERSION "\n");
+err_unregister:
+	while (i--)
+		tty0tty_delete_pair(i);
+	tty0tty_wire_exit();
+err_driver:
+	tty_unregister_driver(tty0tty_tty_driver);
+err_free:
+	for (i = 0; i < tty0tty_minors; i++) {
+		kfree(tty0tty_table[i].xmit.buf);
+		tty_port_destroy(&tty0tty_table[i].port);
+	}
+	tty_driver_kref_put(tty0tty_tty_driver);
+	vfree(tty0tty_table);
 	return retval;
 }
 
 static void __exit tty0tty_exit(void)
 {
 	struct tty0tty_serial *tty0tty;
+	struct tty0tty_group *group, *next;
 	int i;
 
 #ifdef SCULL_DEBUG
 	printk(KERN_DEBUG "%s - \n", __FUNCTION__);
 #endif
-	for (i = 0; i < TTY0TTY_MINORS; ++i)
+	debugfs_remove_recursive(tty0tty_debugfs);
+	misc_deregister(&tty0tty_ctl);
+
+	/* nothing may run on a port any more when it is destroyed */
+	for (i = 0; i < tty0tty_minors; ++i) {
+		tty0tty = &tty0tty_table[i];
+
+		/* close the port */
+		while (atomic_read(&tty0tty->open_count))
+			tty0tty_do_close(tty0tty);
+
+		/* all closed, xmit is empty: nothing arms them again */
+		hrtimer_cancel(&tty0tty->pace_timer);
+		hrtimer_cancel(&tty0tty->delay_timer);
+		cancel_delayed_work_sync(&tty0tty->retry);
+		hrtimer_cancel(&tty0tty->push_timer);
+	}
+
+	for (i = 0; i < tty0tty_minors; ++i)
 	{
-		tty_port_destroy(&tport[i]);
-		tty_unregister_device(tty0tty_tty_driver, i);
+		tty_port_destroy(&tty0tty_table[i].port);
+		if (tty0tty_table[i].wire_dev)
+			device_destroy(tty0tty_wire_class,
+				       MKDEV(MAJOR(tty0tty_wire_devt), i));
+		if (tty0tty_table[i].dev)
+			tty_unregister_device(tty0tty_tty_driver, i);
 	}
+	tty0tty_wire_exit();
 	tty_unregister_driver(tty0tty_tty_driver);
 
-	/* shut down all of the timers and free the memory */
-	for (i = 0; i < TTY0TTY_MINORS; ++i) {
-		tty0tty = tty0tty_table[i];
-		if (tty0tty) {
-			/* close the port */
-			while (tty0tty->open_count)
-				tty0tty_do_close(tty0tty);
-
-			/* shut down our timer and free the memory */
-			kfree(tty0tty);
-			tty0tty_table[i] = NULL;
-		}
+	/* free the memory */
+	for (i = 0; i < tty0tty_minors; ++i) {
+		tty0tty = &tty0tty_table[i];
+		kfree(tty0tty->xmit.buf);
+		kfree(tty0tty->delay);
+		kfree(rcu_dereference_protected(tty0tty->rx_xlat, 1));
+		tty0tty_capture_free(rcu_dereference_protected(tty0tty->capture, 1));
 	}
+	list_for_each_entry_safe(group, next, &tty0tty_groups, list)
+		kfree(group);
+	rcu_barrier();	/* tables and groups freed with kfree_rcu() */
+	vfree(tty0tty_table);
 }
 
 module_init(tty0tty_init);
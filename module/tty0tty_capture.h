@@ -0,0 +1,61 @@
+/* ########################################################################
+
+   tty0tty - linux null modem emulator (module) capture ring layout
+
+   ########################################################################
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Shared with user space: mmap /sys/class/tty/tntN/capture read only
+   after a write to /sys/class/tty/tntN/capture_size. The first page is
+   a struct tty0tty_capture_hdr, the data area follows it.
+   ######################################################################## */
+
+#ifndef _TTY0TTY_CAPTURE_H
+#define _TTY0TTY_CAPTURE_H
+
+#include <linux/types.h>
+
+#define TTY0TTY_CAPTURE_VERSION	1
+
+/*
+ * head counts the bytes ever written to the data area, record n starts
+ * at (its head) & (data_size - 1). The kernel never waits for a reader:
+ * a reader that is data_size or more behind head has lost records and
+ * starts again from head. Read head with acquire semantics, the records
+ * before it are complete; read it again after copying a record, if it
+ * moved data_size past the record the copy may be torn.
+ */
+struct tty0tty_capture_hdr {
+	__u32	version;	/* TTY0TTY_CAPTURE_VERSION */
+	__u32	data_offset;	/* of the data area in the mapping, one page */
+	__u32	data_size;	/* power of two */
+	__u32	pad;
+	__u64	head;
+};
+
+/* record types */
+#define TTY0TTY_CAP_PAD		0	/* the next record is at the start of the area */
+#define TTY0TTY_CAP_DATA	1	/* count bytes written by port */
+#define TTY0TTY_CAP_MODEM	2	/* port changed its output lines */
+#define TTY0TTY_CAP_BREAK	3	/* port started a break */
+
+/*
+ * Records never wrap, 8 bytes aligned. When less than a header is left
+ * at the end of the data area, or a TTY0TTY_CAP_PAD header, the next
+ * record is at its start.
+ */
+struct tty0tty_capture_rec {
+	__u64	time_ns;	/* CLOCK_MONOTONIC */
+	__u16	len;		/* of the record, header and padding included */
+	__u16	count;		/* data bytes after the header */
+	__u8	type;		/* TTY0TTY_CAP_* */
+	__u8	port;		/* 0 the even port of the pair, 1 the odd one */
+	__u8	flags;		/* TTY_NORMAL or the flag the peer receives the data with */
+	__u8	lines;		/* port MCR | MSR, 16550 bits, after the event */
+};
+
+#endif /* _TTY0TTY_CAPTURE_H */
@@ -0,0 +1,130 @@
+/* ########################################################################
+
+   tty0tty - linux null modem emulator (module) tracepoints
+
+   ########################################################################
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   Use with perf or ftrace, ex:
+
+   echo 1 > /sys/kernel/tracing/events/tty0tty/enable
+   cat /sys/kernel/tracing/trace_pipe
+   ######################################################################## */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tty0tty
+
+#if !defined(_TTY0TTY_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TTY0TTY_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* data accepted by tty0tty_write() */
+TRACE_EVENT(tty0tty_write,
+	TP_PROTO(int index, unsigned int count, unsigned int accepted),
+	TP_ARGS(index, count, accepted),
+	TP_STRUCT__entry(
+		__field(int, index)
+		__field(unsigned int, count)
+		__field(unsigned int, accepted)
+	),
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->count = count;
+		__entry->accepted = accepted;
+	),
+	TP_printk("tnt%d count=%u accepted=%u",
+		  __entry->index, __entry->count, __entry->accepted)
+);
+
+/*
+ * data received by to handed to its line discipline, from wrote the last
+ * of it (-1 for /dev/tntdN), count bytes since the previous push
+ */
+TRACE_EVENT(tty0tty_push,
+	TP_PROTO(int from, int to, unsigned int count),
+	TP_ARGS(from, to, count),
+	TP_STRUCT__entry(
+		__field(int, from)
+		__field(int, to)
+		__field(unsigned int, count)
+	),
+	TP_fast_assign(
+		__entry->from = from;
+		__entry->to = to;
+		__entry->count = count;
+	),
+	TP_printk("tnt%d -> tnt%d count=%u",
+		  __entry->from, __entry->to, __entry->count)
+);
+
+/* new MCR/MSR shadow values of a port */
+TRACE_EVENT(tty0tty_modem,
+	TP_PROTO(int index, int mcr, int msr),
+	TP_ARGS(index, mcr, msr),
+	TP_STRUCT__entry(
+		__field(int, index)
+		__field(int, mcr)
+		__field(int, msr)
+	),
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->mcr = mcr;
+		__entry->msr = msr;
+	),
+	TP_printk("tnt%d mcr=0x%02x msr=0x%02x",
+		  __entry->index, __entry->mcr, __entry->msr)
+);
+
+DECLARE_EVENT_CLASS(tty0tty_port,
+	TP_PROTO(int index, int open_count),
+	TP_ARGS(index, open_count),
+	TP_STRUCT__entry(
+		__field(int, index)
+		__field(int, open_count)
+	),
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->open_count = open_count;
+	),
+	TP_printk("tnt%d open_count=%d", __entry->index, __entry->open_count)
+);
+
+DEFINE_EVENT(tty0tty_port, tty0tty_open,
+	TP_PROTO(int index, int open_count),
+	TP_ARGS(index, open_count)
+);
+
+DEFINE_EVENT(tty0tty_port, tty0tty_close,
+	TP_PROTO(int index, int open_count),
+	TP_ARGS(index, open_count)
+);
+
+TRACE_EVENT(tty0tty_termios,
+	TP_PROTO(int index, unsigned int cflag, unsigned int baud),
+	TP_ARGS(index, cflag, baud),
+	TP_STRUCT__entry(
+		__field(int, index)
+		__field(unsigned int, cflag)
+		__field(unsigned int, baud)
+	),
+	TP_fast_assign(
+		__entry->index = index;
+		__entry->cflag = cflag;
+		__entry->baud = baud;
+	),
+	TP_printk("tnt%d cflag=0%o baud=%u",
+		  __entry->index, __entry->cflag, __entry->baud)
+);
+
+#endif /* _TTY0TTY_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tty0tty_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Aggregate throughput of the bridge against its number of event loop
+# threads: each pair carries MB one way, all pairs at once.
+#
+# usage: bench.sh [pairs] [MB] [threads...]    (default 8 64 1 2 4 8)
+#        BRIDGE_OPTS="-p 0-7 -e" bench.sh ...  more options of the bridge
+
+PAIRS=${1:-8}
+MB=${2:-64}
+shift $(( $# < 2 ? $# : 2 ))
+THREADS=${*:-1 2 4 8}
+BRIDGE=$(dirname "$0")/tty0tty
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf $DIR' EXIT
+
+links=""
+for i in $(seq 0 $((PAIRS - 1))); do
+  links="$links $DIR/${i}a $DIR/${i}b"
+done
+
+for t in $THREADS; do
+  # the high-water marks it prints on exit go to the log
+  $BRIDGE -t $t $BRIDGE_OPTS $links > /dev/null 2> $DIR/log &
+  bridge=$!
+  for i in $(seq 0 $((PAIRS - 1))); do
+    while [ ! -e $DIR/${i}b ]; do sleep 0.05; done
+    stty -F $DIR/${i}a raw -echo && stty -F $DIR/${i}b raw -echo || exit 1
+  done
+
+  start=$(date +%s.%N)
+  readers=""
+  for i in $(seq 0 $((PAIRS - 1))); do
+    timeout 120 head -c ${MB}M < $DIR/${i}b > /dev/null &
+    readers="$readers $!"
+    head -c ${MB}M /dev/zero > $DIR/${i}a &
+  done
+  failed=0
+  for r in $readers; do
+    wait $r || failed=1
+  done
+  end=$(date +%s.%N)
+
+  kill $bridge
+  wait $bridge 2> /dev/null
+  rm -f $links
+  if [ $failed = 1 ]; then
+    echo "threads $t: data lost" >&2
+    cat $DIR/log >&2
+    exit 1
+  fi
+  awk -v t=$t -v p=$PAIRS -v mb=$MB -v s=$start -v e=$end 'BEGIN {
+    printf "threads %3d: %4d pairs %8.1f MB/s\n", t, p, p * mb / (e - s) }'
+done
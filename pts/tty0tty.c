@@ -29,8 +29,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#include <poll.h>
+#endif
 
 #if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 42))
 #include <termios.h>
@@ -38,7 +50,67 @@
 #include <termio.h>
 #endif
 
-static char buffer[1024];
+/* ring size of a direction, a power of two, -b */
+static size_t bufsize = 65536;
+
+/*
+ * One direction of a pair: a ring of what was read from a master and is
+ * waiting to be written to the other. head and tail run free, head - tail
+ * bytes are waiting.
+ */
+struct dir
+{
+  char *buf;                    /* bufsize, allocated by the first read */
+  size_t head;                  /* bytes ever read */
+  size_t tail;                  /* bytes ever written */
+  size_t hwm;                   /* most bytes ever waiting, SIGUSR1, atomic */
+#ifdef HAVE_LIBURING
+  int reading;                  /* io_uring: a read is in flight */
+  int writing;                  /* a write is in flight */
+  int parked;                   /* PARK_READ | PARK_WRITE, wait for epfd */
+  int woken;                    /* PARK_*, epfd had an event since queued */
+#endif
+};
+
+/* owned by one worker, aligned so that workers share no cache line */
+struct pair
+{
+  int fd[2];                    /* the two masters */
+  struct dir dir[2];            /* dir[i] goes from fd[i] to fd[!i] */
+  char *name[2];                /* of the ends, for the reports */
+} __attribute__((aligned(64)));
+
+/* for the high-water mark report */
+static struct pair *all_pairs;
+static int all_npairs;
+
+static volatile sig_atomic_t report_hwm;        /* SIGUSR1 */
+static volatile sig_atomic_t quit;              /* SIGINT, SIGTERM */
+static pthread_t signal_thread;                 /* worker 0, gets them */
+
+/* an event loop thread, with its own epoll and its share of the pairs */
+struct worker
+{
+  pthread_t thread;
+  int epfd;
+  int cpu;                      /* pinned to it, -1 for none */
+  struct pair *pairs;           /* its pairs are pairs[first + k * stride] */
+  int npairs;
+  int first;
+  int stride;
+#ifdef HAVE_LIBURING
+  int uring;                    /* try the io_uring backend */
+  struct io_uring ring;
+  int parked;                   /* directions waiting for epfd */
+  int epoll_armed;              /* a poll of epfd is in the ring */
+#endif
+};
+
+/* symlink names of the ends of one pair, NULL for none */
+struct pair_conf
+{
+  char *link[2];
+};
 
 int
 ptym_open(char *pts_name, char *pts_name_s , int pts_namesz)
@@ -110,117 +182,838 @@ tcflush(serialDev, TCIOFLUSH);
   return EXIT_SUCCESS;
 }
 
+/* the waiting bytes of d, in one or two pieces, returns their number */
+int
+dir_data(const struct dir *d, struct iovec *iov)
+{
+  size_t used = d->head - d->tail;
+  size_t off = d->tail & (bufsize - 1);
+  size_t n = used < bufsize - off ? used : bufsize - off;
+
+  iov[0].iov_base = d->buf + off;
+  iov[0].iov_len = n;
+  iov[1].iov_base = d->buf;
+  iov[1].iov_len = used - n;
+  return used > n ? 2 : 1;
+}
+
+/* the free space of d, in one or two pieces */
+int
+dir_space(const struct dir *d, struct iovec *iov)
+{
+  size_t space = bufsize - (d->head - d->tail);
+  size_t off = d->head & (bufsize - 1);
+  size_t n = space < bufsize - off ? space : bufsize - off;
+
+  iov[0].iov_base = d->buf + off;
+  iov[0].iov_len = n;
+  iov[1].iov_base = d->buf;
+  iov[1].iov_len = space - n;
+  return space > n ? 2 : 1;
+}
+
 void
-copydata(int fdfrom, int fdto)
+dir_fill(struct dir *d, size_t n)
+{
+  d->head += n;
+  /* the owner is the only writer, the report reads it from worker 0 */
+  if (d->head - d->tail > d->hwm)
+    __atomic_store_n(&d->hwm, d->head - d->tail, __ATOMIC_RELAXED);
+}
+
+/*
+ * Move data from fd[i] to fd[!i] through the ring of dir[i] until
+ * neither side can go on. The masters are edge triggered in epoll:
+ * whatever stops us here (no data, the other side full, a slave closed)
+ * ends with an event on one of them, and pending data waits in the ring,
+ * nothing is discarded. A full ring only stops the reads of this
+ * direction, the other one has its own.
+ */
+int
+pump(struct pair *p, int i)
+{
+  struct dir *d = &p->dir[i];
+  struct iovec iov[2];
+  int can_read = 1;
+  int can_write = 1;
+  int avail;
+  ssize_t n;
+
+  /*
+   * An idle pair costs no buffer: a direction gets its ring when its
+   * master has data. Data coming later is a new EPOLLIN edge.
+   */
+  if (d->buf == NULL)
+  {
+    if (ioctl(p->fd[i], FIONREAD, &avail) < 0 || avail <= 0)
+      return 0;
+    if ((d->buf = malloc(bufsize)) == NULL)
+    {
+      perror("malloc");
+      return -1;
+    }
+  }
+
+  while ((can_write && d->head != d->tail) ||
+         (can_read && d->head - d->tail < bufsize))
+  {
+    if (can_write && d->head != d->tail)
+    {
+      n = writev(p->fd[!i], iov, dir_data(d, iov));
+      if (n > 0)
+        d->tail += n;
+      else if (n == 0 || errno == EAGAIN || errno == EIO)
+        can_write = 0;          /* wait for EPOLLOUT */
+      else if (errno != EINTR)
+      {
+        perror("write");
+        return -1;
+      }
+    }
+
+    if (can_read && d->head - d->tail < bufsize)
+    {
+      n = readv(p->fd[i], iov, dir_space(d, iov));
+      if (n > 0)
+        dir_fill(d, n);
+      // EIO: the slave is closed, its next open and write is an event
+      else if (n == 0 || errno == EAGAIN || errno == EIO)
+        can_read = 0;
+      else if (errno != EINTR)
+      {
+        perror("read");
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* per direction high-water marks, to choose -b */
+void
+report(void)
+{
+  struct pair *p;
+  int k, i;
+
+  for (k = 0; k < all_npairs; k++)
+  {
+    p = &all_pairs[k];
+    for (i = 0; i < 2; i++)
+      fprintf(stderr, "(%s) -> (%s): hwm %zu/%zu\n", p->name[i], p->name[!i],
+              __atomic_load_n(&p->dir[i].hwm, __ATOMIC_RELAXED), bufsize);
+  }
+}
+
+void
+on_signal(int sig)
+{
+  if (sig == SIGUSR1)
+    report_hwm = 1;
+  else
+    quit = 1;
+}
+
+/*
+ * called by the loops between two waits. The signals are blocked in
+ * the other workers: only worker 0 gets them and reports.
+ */
+void
+check_signals(void)
+{
+  if (!pthread_equal(pthread_self(), signal_thread))
+    return;
+  if (report_hwm)
+  {
+    report_hwm = 0;
+    report();
+  }
+  if (quit)
+  {
+    report();
+    exit(0);
+  }
+}
+
+/* "-" is no symlink for that end */
+char *
+link_name(const char *arg)
+{
+  char *name;
+
+  if (strcmp(arg, "-") == 0)
+    return NULL;
+  if ((name = strdup(arg)) == NULL)
+  {
+    perror("strdup");
+    exit(1);
+  }
+  return name;
+}
+
+/*
+ * Config file, one pair per line with the symlink names of its ends,
+ * "-" for no link. Empty lines and lines starting with '#' are skipped:
+ *
+ *   /tmp/gps0 /tmp/gps1
+ *   - -
+ */
+int
+read_conf(const char *path, struct pair_conf **conf, int *nconf)
 {
-  ssize_t br, bw;
-  char *pbuf = buffer;
-  br = read(fdfrom, buffer, 1024);
-  if (br < 0)
+  char line[2048];
+  char name1[1024];
+  char name2[1024];
+  struct pair_conf *c;
+  FILE *fp;
+  int lineno = 0;
+
+  if ((fp = fopen(path, "r")) == NULL)
   {
-    if (errno == EAGAIN || errno == EIO)
+    perror(path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    lineno++;
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+      continue;
+    if (sscanf(line, "%1023s %1023s", name1, name2) != 2)
     {
-      br = 0;
+      fprintf(stderr, "%s:%d: two names expected\n", path, lineno);
+      fclose(fp);
+      return -1;
     }
-    else
+    c = realloc(*conf, (*nconf + 1) * sizeof(**conf));
+    if (c == NULL)
     {
-      perror("read");
+      perror("realloc");
       exit(1);
     }
+    *conf = c;
+    c[*nconf].link[0] = link_name(name1);
+    c[*nconf].link[1] = link_name(name2);
+    (*nconf)++;
   }
-  if (br > 0)
+
+  fclose(fp);
+  return 0;
+}
+
+/* open the two masters of a pair, link their slaves and register them in epfd */
+int
+pair_open(struct pair *p, const struct pair_conf *c, int epfd)
+{
+  char master[1024];
+  char slave[2][1024];
+  struct epoll_event ev;
+  int i;
+
+  for (i = 0; i < 2; i++)
   {
-    do
+    p->fd[i] = ptym_open(master, slave[i], 1024);
+    if (p->fd[i] < 0)
     {
-      do
-      {
-        bw = write(fdto, pbuf, br);
-        if (bw > 0)
-        {
-          pbuf += bw;
-          br -= bw;
-        }
-      } while (br > 0 && bw > 0);
-    } while (bw < 0 && errno == EAGAIN);
-    if (bw <= 0)
-    {
-      // kernel buffer may be full, but we can recover
-      fprintf(stderr, "Write error, br=%d bw=%d\n", br, bw);
-      usleep(500000);
-      // discard input
-      while (read(fdfrom, buffer, 1024) > 0)
-        ;
+      fprintf(stderr, "Cannot open a pty: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    if (c->link[i] == NULL)
+      continue;
+    unlink(c->link[i]);
+    if (symlink(slave[i], c->link[i]) < 0)
+    {
+      fprintf(stderr, "Cannot create: %s\n", c->link[i]);
+      return -1;
+    }
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    p->name[i] = strdup(c->link[i] ? c->link[i] : slave[i]);
+    if (p->name[i] == NULL)
+    {
+      perror("strdup");
+      return -1;
+    }
+  }
+  printf("(%s) <=> (%s)\n", p->name[0], p->name[1]);
+
+  conf_ser(p->fd[0]);
+  conf_ser(p->fd[1]);
+
+  /* any event on a master may unblock both directions */
+  for (i = 0; i < 2; i++)
+  {
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = p;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, p->fd[i], &ev) < 0)
+    {
+      perror("epoll_ctl");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* "0,2,4-7" to a list of cpus, returns their number or -1 */
+int
+parse_cpus(const char *arg, int **cpus)
+{
+  const char *s = arg;
+  char *end;
+  int *c = NULL;
+  int n = 0;
+  long first, last;
+
+  while (*s)
+  {
+    first = last = strtol(s, &end, 10);
+    if (end == s || first < 0)
+      return -1;
+    if (*end == '-')
+    {
+      s = end + 1;
+      last = strtol(s, &end, 10);
+      if (end == s || last < first)
+        return -1;
+    }
+    for (; first <= last; first++)
+    {
+      if ((c = realloc(c, (n + 1) * sizeof(*c))) == NULL)
+        return -1;
+      c[n++] = first;
+    }
+    if (*end == ',')
+      end++;
+    else if (*end)
+      return -1;
+    s = end;
+  }
+
+  *cpus = c;
+  return n;
+}
+
+int
+event_loop(int epfd)
+{
+  struct epoll_event events[64];
+  int i, n;
+
+  while(1)
+  {
+    check_signals();
+    n = epoll_wait(epfd, events, 64, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+      struct pair *p = events[i].data.ptr;
+
+      if (pump(p, 0) < 0 || pump(p, 1) < 0)
+        return -1;
     }
   }
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * io_uring backend. Each direction has up to a read and a write in
+ * flight: the read of its master into the free space of its ring and
+ * the write of the waiting bytes to the other master. Each completion
+ * queues what its direction can do next. Under load one
+ * io_uring_submit_and_wait() forwards many chunks. A master that is not
+ * ready gets a poll linked before the request. A read or write whose
+ * slave is closed (EIO) is parked until the edge triggered epfd, polled
+ * through the ring, has an event for it.
+ *
+ * The buffers are not registered: that would pin two rings per pair,
+ * idle or not, against RLIMIT_MEMLOCK. As with epoll, a direction gets
+ * its ring when its master first has data, until then only a poll of
+ * it is in flight.
+ *
+ * The request kind and direction are in the low bits of the user data,
+ * pairs are 64 bytes aligned.
+ */
+#define OP_READ         0
+#define OP_WRITE        2
+#define OP_POLL         4       /* linked before a request, ignored */
+#define OP_EPOLL        6       /* epfd has events, no pointer */
+#define OP_WAIT         8       /* the master of a direction without a ring */
+
+#define PARK_READ       1
+#define PARK_WRITE      2
+
+struct io_uring_sqe *
+uring_sqe(struct worker *w)
+{
+  struct io_uring_sqe *sqe;
+
+  /* the ring is full, make room */
+  while ((sqe = io_uring_get_sqe(&w->ring)) == NULL)
+    io_uring_submit(&w->ring);
+  return sqe;
+}
+
+/* a read or a write of direction i, of the first piece of its ring */
+void
+uring_queue(struct worker *w, struct pair *p, int i, int write, int poll)
+{
+  struct dir *d = &p->dir[i];
+  struct io_uring_sqe *sqe;
+  struct iovec iov[2];
+  int fd = write ? p->fd[!i] : p->fd[i];
+
+  if (poll)
+  {
+    sqe = uring_sqe(w);
+    io_uring_prep_poll_add(sqe, fd, write ? POLLOUT : POLLIN);
+    io_uring_sqe_set_data(sqe, (char *)p + (OP_POLL | i));
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+  }
+
+  sqe = uring_sqe(w);
+  if (write)
+  {
+    dir_data(d, iov);
+    io_uring_prep_write(sqe, fd, iov[0].iov_base, iov[0].iov_len, 0);
+    io_uring_sqe_set_data(sqe, (char *)p + (OP_WRITE | i));
+    d->writing = 1;
+    d->woken &= ~PARK_WRITE;
+  }
+  else if (d->buf == NULL)
+  {
+    io_uring_prep_poll_add(sqe, fd, POLLIN);
+    io_uring_sqe_set_data(sqe, (char *)p + (OP_WAIT | i));
+    d->reading = 1;
+    d->woken &= ~PARK_READ;
+  }
   else
   {
-    usleep(100000);
+    dir_space(d, iov);
+    io_uring_prep_read(sqe, fd, iov[0].iov_base, iov[0].iov_len, 0);
+    io_uring_sqe_set_data(sqe, (char *)p + (OP_READ | i));
+    d->reading = 1;
+    d->woken &= ~PARK_READ;
   }
 }
 
-int main(int argc, char* argv[])
+/* queue what direction i can do and has not in flight or parked */
+void
+uring_next(struct worker *w, struct pair *p, int i)
 {
-  char master1[1024];
-  char slave1[1024];
-  char master2[1024];
-  char slave2[1024];
+  struct dir *d = &p->dir[i];
 
-  int fd1;
-  int fd2;
+  if (!d->writing && !(d->parked & PARK_WRITE) && d->head != d->tail)
+    uring_queue(w, p, i, 1, 0);
+  if (!d->reading && !(d->parked & PARK_READ) && d->head - d->tail < bufsize)
+    uring_queue(w, p, i, 0, 0);
+}
 
-  fd_set rfds;
-  int retval;
+void
+uring_arm_epoll(struct worker *w)
+{
+  struct io_uring_sqe *sqe;
+
+  if (w->epoll_armed)
+    return;
+  sqe = uring_sqe(w);
+  io_uring_prep_poll_add(sqe, w->epfd, POLLIN);
+  io_uring_sqe_set_data(sqe, (void *)OP_EPOLL);
+  w->epoll_armed = 1;
+}
 
-  fd1=ptym_open(master1,slave1,1024);
+/*
+ * epfd only matters while a direction is parked, else its events wait.
+ * The event of the pair may already have been taken by uring_unpark()
+ * while the failed request was in flight, even in the same batch of
+ * completions: then the request is queued again instead.
+ */
+void
+uring_park(struct worker *w, struct pair *p, int i, int what)
+{
+  struct dir *d = &p->dir[i];
 
-  fd2=ptym_open(master2,slave2,1024);
+  if (d->woken & what)
+  {
+    uring_next(w, p, i);
+    return;
+  }
+  d->parked |= what;
+  w->parked++;
+  uring_arm_epoll(w);
+}
 
-  if (argc >= 3)
+void
+uring_unpark(struct worker *w)
+{
+  struct epoll_event events[64];
+  struct pair *p;
+  struct dir *d;
+  int i, j, n;
+
+  w->epoll_armed = 0;
+  do
   {
-    unlink(argv[1]);
-    unlink(argv[2]);
-    if (symlink(slave1, argv[1]) < 0)
-	{
-      fprintf(stderr, "Cannot create: %s\n", argv[1]);
-      return 1;
+    n = epoll_wait(w->epfd, events, 64, 0);
+    for (i = 0; i < n; i++)
+    {
+      p = events[i].data.ptr;
+      for (j = 0; j < 2; j++)
+      {
+        d = &p->dir[j];
+        /* for the requests in flight, cleared when one is queued */
+        d->woken = PARK_READ | PARK_WRITE;
+        if (d->parked & PARK_READ)
+          w->parked--;
+        if (d->parked & PARK_WRITE)
+          w->parked--;
+        d->parked = 0;
+        uring_next(w, p, j);
+      }
     }
-    if (symlink(slave2, argv[2]) < 0) {
-      fprintf(stderr, "Cannot create: %s\n", argv[2]);
-      return 1;
+  } while (n == 64);
+
+  if (w->parked)
+    uring_arm_epoll(w);
+}
+
+int
+uring_complete(struct worker *w, struct io_uring_cqe *cqe)
+{
+  uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+  struct pair *p;
+  struct dir *d;
+  int op = data & 14;
+  int i = data & 1;
+  int res = cqe->res;
+
+  if (op == OP_POLL)
+    return 0;
+  if (op == OP_EPOLL)
+  {
+    uring_unpark(w);
+    return 0;
+  }
+  p = (struct pair *)(data & ~(uintptr_t)15);
+  d = &p->dir[i];
+
+  if (op == OP_WRITE)
+    d->writing = 0;
+  else
+    d->reading = 0;
+
+  if (op == OP_WAIT)
+  {
+    /* a hung up master has nothing to read yet */
+    if (res < 0 || !(res & POLLIN) || (res & POLLHUP))
+    {
+      uring_park(w, p, i, PARK_READ);
+      return 0;
     }
-    printf("(%s) <=> (%s)\n",argv[1],argv[2]);
+    if ((d->buf = malloc(bufsize)) == NULL)
+    {
+      perror("malloc");
+      return -1;
+    }
+    uring_next(w, p, i);
+    return 0;
+  }
+
+  if (res == -EAGAIN || res == -EINTR)
+  {
+    uring_queue(w, p, i, op == OP_WRITE, 1);
+    return 0;
+  }
+  // EIO: the slave is closed, ECANCELED: its linked poll failed
+  if (res == -EIO || res == -ECANCELED || res == 0)
+  {
+    uring_park(w, p, i, op == OP_READ ? PARK_READ : PARK_WRITE);
+    return 0;
   }
-  else {
-    printf("(%s) <=> (%s)\n",slave1,slave2);
+  if (res < 0)
+  {
+    fprintf(stderr, "%s: %s\n", op == OP_READ ? "read" : "write", strerror(-res));
+    return -1;
   }
 
-  conf_ser(fd1);
-  conf_ser(fd2);
+  if (op == OP_READ)
+    dir_fill(d, res);
+  else
+    d->tail += res;
+  uring_next(w, p, i);
+  return 0;
+}
+
+/* the ring of the worker, 0 or a -errno */
+int
+uring_setup(struct worker *w)
+{
+  struct pair *p;
+  unsigned entries = 8;
+  int ret;
+  int k, j;
+
+  /* a poll and a request per read and write, and the poll of epfd */
+  while (entries < 8 * (unsigned)w->npairs + 1 && entries < 4096)
+    entries *= 2;
+  ret = io_uring_queue_init(entries, &w->ring, 0);
+  if (ret < 0)
+    return ret;
+
+  for (k = 0; k < w->npairs; k++)
+  {
+    p = &w->pairs[w->first + k * w->stride];
+    for (j = 0; j < 2; j++)
+      uring_next(w, p, j);
+  }
+  return 0;
+}
+
+int
+uring_loop(struct worker *w)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  unsigned count;
+  int ret;
 
   while(1)
   {
-    FD_ZERO(&rfds);
-    FD_SET(fd1, &rfds);
-    FD_SET(fd2, &rfds);
+    check_signals();
+    ret = io_uring_submit_and_wait(&w->ring, 1);
+    if (ret < 0 && ret != -EINTR && ret != -EBUSY)
+    {
+      fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+      return -1;
+    }
 
-    retval = select(fd2 + 1, &rfds, NULL, NULL, NULL);
-    if (retval == -1)
+    count = 0;
+    io_uring_for_each_cqe(&w->ring, head, cqe)
     {
-      perror("select");
-      return 1;
+      if (uring_complete(w, cqe) < 0)
+        return -1;
+      count++;
+    }
+    io_uring_cq_advance(&w->ring, count);
+  }
+}
+#endif
+
+void *
+worker_run(void *arg)
+{
+  struct worker *w = arg;
+  cpu_set_t set;
+
+  if (w->cpu >= 0)
+  {
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      fprintf(stderr, "Cannot pin a worker to cpu %d\n", w->cpu);
+  }
+
+#ifdef HAVE_LIBURING
+  if (w->uring)
+  {
+    int ret = uring_setup(w);
+
+    if (ret == 0 && uring_loop(w) < 0)
+      exit(1);
+    /* old kernel, io_uring disabled or memlock limit: same pairs in epoll */
+    fprintf(stderr, "io_uring: %s, using epoll\n", strerror(-ret));
+  }
+#endif
+
+  if (event_loop(w->epfd) < 0)
+    exit(1);
+  return NULL;
+}
+
+void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-n pairs] [-f file] [-t threads] [-p cpus] [-b bytes] [-e]\n"
+          "          [link1 link2]...\n"
+          "  -n pairs  number of pairs (default 1, or one per link pair)\n"
+          "  -f file   pairs from a file, two link names per line, - for none\n"
+          "  -t threads  event loop threads, the pairs are shared among them\n"
+          "              (default 1, 0 for one per cpu)\n"
+          "  -p cpus   pin the threads to these cpus, in turn, ex: 0,2,4-7\n"
+          "  -b bytes  ring buffer of each direction (default 65536), rounded\n"
+          "            up to a power of two; SIGUSR1 prints their high-water marks\n"
+          "  -e        epoll even when built with io_uring\n"
+          "  link1 link2  symlinks to the slaves of a pair, - for none\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+  struct pair_conf *conf = NULL;
+  struct pair *pairs;
+  struct worker *workers;
+  struct rlimit rl;
+  struct sigaction sa;
+  sigset_t sigs;
+  long size;
+  int *cpus = NULL;
+  int ncpus = 0;
+  int nthreads = 1;
+#ifdef HAVE_LIBURING
+  int uring = 1;
+#endif
+  int npairs = 0;
+  int nconf = 0;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "n:f:t:p:b:eh")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      npairs = atoi(optarg);
+      if (npairs <= 0)
+        usage(argv[0]);
+      break;
+    case 'f':
+      if (read_conf(optarg, &conf, &nconf) < 0)
+        return 1;
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      if (nthreads < 0)
+        usage(argv[0]);
+      if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+      break;
+    case 'p':
+      ncpus = parse_cpus(optarg, &cpus);
+      if (ncpus <= 0)
+        usage(argv[0]);
+      break;
+    case 'b':
+      size = atol(optarg);
+      if (size < 256 || size > (64L << 20))
+        usage(argv[0]);
+      for (bufsize = 256; bufsize < (size_t)size; bufsize *= 2)
+        ;
+      break;
+    case 'e':
+#ifdef HAVE_LIBURING
+      uring = 0;
+#endif
+      break;
+    default:
+      usage(argv[0]);
     }
-    if (FD_ISSET(fd1, &rfds))
+  }
+
+  if ((argc - optind) % 2)
+    usage(argv[0]);
+  for (i = optind; i < argc; i += 2)
+  {
+    conf = realloc(conf, (nconf + 1) * sizeof(*conf));
+    if (conf == NULL)
     {
-      copydata(fd1, fd2);
+      perror("realloc");
+      return 1;
     }
-    if (FD_ISSET(fd2, &rfds))
+    conf[nconf].link[0] = link_name(argv[i]);
+    conf[nconf].link[1] = link_name(argv[i + 1]);
+    nconf++;
+  }
+
+  /* pairs beyond the configured ones have no links */
+  if (npairs < nconf)
+    npairs = nconf ? nconf : 1;
+  if (nthreads > npairs)
+    nthreads = npairs;
+  conf = realloc(conf, npairs * sizeof(*conf));
+  pairs = aligned_alloc(64, npairs * sizeof(*pairs));
+  workers = calloc(nthreads, sizeof(*workers));
+  if (conf == NULL || pairs == NULL || workers == NULL)
+  {
+    perror("calloc");
+    return 1;
+  }
+  memset(conf + nconf, 0, (npairs - nconf) * sizeof(*conf));
+  memset(pairs, 0, npairs * sizeof(*pairs));
+  all_pairs = pairs;
+  all_npairs = npairs;
+
+  /* two masters per pair */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  for (i = 0; i < nthreads; i++)
+  {
+    workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (workers[i].epfd < 0)
     {
-      copydata(fd2, fd1);
+      perror("epoll_create1");
+      return 1;
     }
+    workers[i].cpu = ncpus ? cpus[i % ncpus] : -1;
+    workers[i].pairs = pairs;
+    workers[i].first = i;
+    workers[i].stride = nthreads;
+    workers[i].npairs = (npairs - i + nthreads - 1) / nthreads;
+#ifdef HAVE_LIBURING
+    workers[i].uring = uring;
+#endif
   }
 
-  close(fd1);
-  close(fd2);
+  /* a pair belongs to one worker, the data path takes no lock */
+  for (i = 0; i < npairs; i++)
+  {
+    if (pair_open(&pairs[i], &conf[i], workers[i % nthreads].epfd) < 0)
+      return 1;
+  }
+  fflush(stdout);
+
+  /* no SA_RESTART: the signals interrupt the waits of the loops */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  /* the main thread is worker 0, the others inherit the blocked signals */
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGUSR1);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+  signal_thread = pthread_self();
+  for (i = 1; i < nthreads; i++)
+  {
+    if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0)
+    {
+      fprintf(stderr, "Cannot create a worker thread\n");
+      return 1;
+    }
+  }
+  pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+  worker_run(&workers[0]);
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Reader wakeups/s against throughput for several coalesce_usecs of the
+# receiving port, with small writes like a chatty device. Needs root for
+# the sysfs attributes and tnt_bench built next to it.
+#
+# usage: coalesce_bench.sh [MB] [port1 port2]    (default 16 tnt0 tnt1)
+
+MB=${1:-16}
+P1=${2:-tnt0}
+P2=${3:-tnt1}
+RX=/sys/class/tty/$P2
+BENCH=$(dirname "$0")/tnt_bench
+
+old=$(cat $RX/coalesce_usecs) || exit 1
+
+for usecs in 0 100 1000 10000; do
+  echo $usecs > $RX/coalesce_usecs || exit 1
+  out=$($BENCH -s $MB -b 64 /dev/$P1 /dev/$P2) || exit 1
+  # the counters of a port are kept after its last close
+  pushes=$(awk '$1 == "pushes" { print $2 }' $RX/stats)
+  echo "$out" | awk -v usecs=$usecs -v pushes=$pushes '
+    { secs = $(NF - 3); mbs = $(NF - 1) }
+    END { printf "coalesce_usecs %6d: %8.1f MB/s %10.0f wakeups/s\n",
+                 usecs, mbs, pushes / secs }'
+done
+
+echo $old > $RX/coalesce_usecs
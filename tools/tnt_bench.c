@@ -0,0 +1,286 @@
+/* ########################################################################
+
+   tnt_bench - throughput of a tty0tty pair
+
+   ########################################################################
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   Writes a stream of data to one end of a pair and reads it from the
+   other, and prints the MB/s. Several writers on the same port (-w)
+   check that concurrent producers neither lose nor duplicate bytes: the
+   sums of the bytes sent and received must match.
+   ######################################################################## */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <termios.h>
+#include <time.h>
+
+#define MAX_WRITERS 64
+
+static size_t total = 256 << 20;        /* bytes per direction, -s */
+static size_t block = 4096;             /* bytes per write, -b */
+static int nwriters = 1;                /* -w */
+
+struct writer
+{
+  pthread_t thread;
+  const char *port;
+  int fd;
+  int seed;
+  size_t count;                         /* its share of total */
+  uint64_t sum;                         /* of the bytes it wrote */
+};
+
+/* one direction, writers on from, read from to */
+struct dir
+{
+  pthread_t thread;
+  const char *from;
+  const char *to;
+  struct writer writer[MAX_WRITERS];
+  uint64_t sum;                         /* of the bytes read */
+  size_t received;
+  double secs;
+  int failed;
+};
+
+double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+port_open(const char *port)
+{
+  struct termios tio;
+  int fd;
+
+  if ((fd = open(port, O_RDWR | O_NOCTTY)) < 0)
+  {
+    perror(port);
+    return -1;
+  }
+  if (tcgetattr(fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+void *
+writer_run(void *arg)
+{
+  struct writer *w = arg;
+  unsigned char *buf;
+  size_t left = w->count;
+  size_t i, n;
+  ssize_t r;
+
+  if ((buf = malloc(block)) == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+  for (i = 0; i < block; i++)
+    buf[i] = (unsigned char)(i * 31 + w->seed);
+
+  while (left)
+  {
+    n = left < block ? left : block;
+    r = write(w->fd, buf, n);
+    if (r < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("write");
+      exit(1);
+    }
+    for (i = 0; i < (size_t)r; i++)
+      w->sum += buf[i];
+    left -= r;
+  }
+  free(buf);
+  return NULL;
+}
+
+void *
+dir_run(void *arg)
+{
+  struct dir *d = arg;
+  struct pollfd pfd;
+  unsigned char *buf;
+  double start;
+  ssize_t r;
+  size_t i;
+  int k;
+
+  if ((buf = malloc(65536)) == NULL)
+  {
+    perror("malloc");
+    exit(1);
+  }
+  pfd.fd = port_open(d->to);
+  pfd.events = POLLIN;
+  if (pfd.fd < 0)
+    exit(1);
+  for (k = 0; k < nwriters; k++)
+  {
+    d->writer[k].port = d->from;
+    d->writer[k].seed = k;
+    d->writer[k].count = total / nwriters + (k < (int)(total % nwriters));
+    if ((d->writer[k].fd = port_open(d->from)) < 0)
+      exit(1);
+  }
+
+  start = now();
+  for (k = 0; k < nwriters; k++)
+  {
+    if (pthread_create(&d->writer[k].thread, NULL, writer_run, &d->writer[k]) != 0)
+    {
+      fprintf(stderr, "Cannot create a writer thread\n");
+      exit(1);
+    }
+  }
+
+  /* a pause of 5 s means the rest is lost */
+  while (d->received < total)
+  {
+    if (poll(&pfd, 1, 5000) == 0)
+    {
+      /* the writers may be blocked for good, do not join them */
+      fprintf(stderr, "%s -> %s: %zu of %zu bytes received, DATA LOST\n",
+              d->from, d->to, d->received, total);
+      exit(1);
+    }
+    r = read(pfd.fd, buf, 65536);
+    if (r < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      perror("read");
+      exit(1);
+    }
+    for (i = 0; i < (size_t)r; i++)
+      d->sum += buf[i];
+    d->received += r;
+  }
+  d->secs = now() - start;
+
+  for (k = 0; k < nwriters; k++)
+  {
+    pthread_join(d->writer[k].thread, NULL);
+    d->sum -= d->writer[k].sum;
+    close(d->writer[k].fd);
+  }
+  if (d->sum)
+    d->failed = 1;
+  close(pfd.fd);
+  free(buf);
+  return NULL;
+}
+
+void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-s MB] [-b bytes] [-w writers] [-d] [port1 port2]\n"
+          "  -s MB       data sent per direction (default 256)\n"
+          "  -b bytes    size of each write (default 4096)\n"
+          "  -w writers  threads writing port1 at once, each with its own fd\n"
+          "  -d          both directions at once\n"
+          "  port1 port2 the pair, default /dev/tnt0 /dev/tnt1\n",
+          prog);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct dir dir[2];
+  const char *port[2] = { "/dev/tnt0", "/dev/tnt1" };
+  int ndirs = 1;
+  int failed = 0;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "s:b:w:dh")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      total = (size_t)atol(optarg) << 20;
+      if (!total)
+        usage(argv[0]);
+      break;
+    case 'b':
+      block = atol(optarg);
+      if (block < 1 || block > (1 << 20))
+        usage(argv[0]);
+      break;
+    case 'w':
+      nwriters = atoi(optarg);
+      if (nwriters < 1 || nwriters > MAX_WRITERS)
+        usage(argv[0]);
+      break;
+    case 'd':
+      ndirs = 2;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind == 2)
+  {
+    port[0] = argv[optind];
+    port[1] = argv[optind + 1];
+  }
+  else if (argc != optind)
+    usage(argv[0]);
+
+  memset(dir, 0, sizeof(dir));
+  for (i = 0; i < ndirs; i++)
+  {
+    dir[i].from = port[i];
+    dir[i].to = port[!i];
+    if (pthread_create(&dir[i].thread, NULL, dir_run, &dir[i]) != 0)
+    {
+      fprintf(stderr, "Cannot create a thread\n");
+      return 1;
+    }
+  }
+
+  for (i = 0; i < ndirs; i++)
+  {
+    pthread_join(dir[i].thread, NULL);
+    printf("%s -> %s: %zu bytes in %.3f s, %.1f MB/s%s\n", dir[i].from,
+           dir[i].to, dir[i].received, dir[i].secs,
+           dir[i].received / dir[i].secs / (1 << 20),
+           dir[i].failed ? ", DATA LOST OR CORRUPTED" : "");
+    failed |= dir[i].failed;
+  }
+  return failed;
+}
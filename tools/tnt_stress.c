@@ -0,0 +1,226 @@
+/* ########################################################################
+
+   tnt_stress - open, close, write and modem line stress of a tty0tty pair
+
+   ########################################################################
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   Threads open and close both ends, write to them, read them and
+   change their modem lines at the same time, for a kernel with lockdep
+   or KASAN to find races. One file of each end stays open all along
+   with DTR and RTS up, so each end must see CTS, DSR and CD up the whole
+   time: closing one of several files of a port must not drop the lines
+   of its peer.
+   ######################################################################## */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#define LINES_IN (TIOCM_CTS | TIOCM_DSR | TIOCM_CAR)
+
+static const char *port[2] = { "/dev/tnt0", "/dev/tnt1" };
+static volatile int stop;
+static int modem = 1;                   /* the ports have modem lines */
+
+static unsigned long opens;
+static unsigned long writes;
+static unsigned long modems;
+static unsigned long violations;
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+count(unsigned long *counter, unsigned long n)
+{
+  pthread_mutex_lock(&count_lock);
+  *counter += n;
+  pthread_mutex_unlock(&count_lock);
+}
+
+int
+port_open(const char *name)
+{
+  struct termios tio;
+  int fd;
+
+  if ((fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0)
+    return -1;
+  if (tcgetattr(fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CRTSCTS | HUPCL);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+/* open a port, write, touch its lines without dropping DTR and RTS, close */
+void *
+churn_run(void *arg)
+{
+  const char *name = port[(long)arg & 1];
+  unsigned int seed = (unsigned int)(long)arg;
+  char buf[256];
+  int bits;
+  int fd;
+
+  memset(buf, 'x', sizeof(buf));
+  while (!stop)
+  {
+    if ((fd = port_open(name)) < 0)
+    {
+      perror(name);
+      exit(1);
+    }
+    count(&opens, 1);
+
+    if (write(fd, buf, 1 + rand_r(&seed) % sizeof(buf)) > 0)
+      count(&writes, 1);
+
+    bits = TIOCM_DTR | TIOCM_RTS;
+    if (ioctl(fd, TIOCMBIS, &bits) == 0 && ioctl(fd, TIOCMGET, &bits) == 0)
+      count(&modems, 1);
+
+    if (rand_r(&seed) % 4 == 0)
+      tcflush(fd, TCOFLUSH);
+    close(fd);
+  }
+  return NULL;
+}
+
+/* keeps data flowing, a full port would only test the blocking path */
+void *
+reader_run(void *arg)
+{
+  int fd = (long)arg;
+  char buf[4096];
+
+  while (!stop)
+  {
+    if (read(fd, buf, sizeof(buf)) <= 0)
+      usleep(100);
+  }
+  return NULL;
+}
+
+/* the lines the other end keeps up must never drop */
+void *
+check_run(void *arg)
+{
+  int fd = (long)arg;
+  int bits;
+
+  while (!stop)
+  {
+    if (ioctl(fd, TIOCMGET, &bits) < 0)
+      return NULL;
+    if ((bits & LINES_IN) != LINES_IN)
+      count(&violations, 1);
+  }
+  return NULL;
+}
+
+void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [-t seconds] [-n threads] [port1 port2]\n"
+          "  -t seconds  duration (default 10)\n"
+          "  -n threads  open/write/close threads per end (default 4)\n"
+          "  port1 port2 the pair, default /dev/tnt0 /dev/tnt1\n",
+          prog);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  pthread_t thread[2 * 64 + 4];
+  int nthread = 0;
+  int holder[2];
+  int seconds = 10;
+  int nchurn = 4;
+  int bits;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "t:n:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 't':
+      seconds = atoi(optarg);
+      if (seconds <= 0)
+        usage(argv[0]);
+      break;
+    case 'n':
+      nchurn = atoi(optarg);
+      if (nchurn < 1 || nchurn > 64)
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind == 2)
+  {
+    port[0] = argv[optind];
+    port[1] = argv[optind + 1];
+  }
+  else if (argc != optind)
+    usage(argv[0]);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  for (i = 0; i < 2; i++)
+  {
+    if ((holder[i] = port_open(port[i])) < 0)
+    {
+      perror(port[i]);
+      return 1;
+    }
+    bits = TIOCM_DTR | TIOCM_RTS;
+    if (ioctl(holder[i], TIOCMBIS, &bits) < 0)
+      modem = 0;
+  }
+  if (!modem)
+    fprintf(stderr, "no modem lines, only open/close/write are tested\n");
+
+  for (i = 0; i < 2 * nchurn; i++)
+    pthread_create(&thread[nthread++], NULL, churn_run, (void *)(long)i);
+  for (i = 0; i < 2; i++)
+  {
+    pthread_create(&thread[nthread++], NULL, reader_run, (void *)(long)holder[i]);
+    if (modem)
+      pthread_create(&thread[nthread++], NULL, check_run, (void *)(long)holder[i]);
+  }
+
+  sleep(seconds);
+  stop = 1;
+  for (i = 0; i < nthread; i++)
+    pthread_join(thread[i], NULL);
+
+  printf("%lu opens, %lu writes, %lu modem changes, %lu times CTS/DSR/CD down\n",
+         opens, writes, modems, violations);
+  close(holder[0]);
+  close(holder[1]);
+  return violations ? 1 : 0;
+}